@@ -0,0 +1,142 @@
+/*
+ * KLDSampler.cpp
+ *
+ * KLD-sampling of the number of particles.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include "KLDSampler.h"
+
+KLDSampler::KLDSampler(double epsilon, int min_particles, int max_particles, double z) :
+    epsilon(epsilon), z(z), min_particles(min_particles), max_particles(max_particles) {}
+
+void KLDSampler::setBinSize(double x, double y, double theta) {
+  bin_x = x;
+  bin_y = y;
+  bin_theta = theta;
+}
+
+int KLDSampler::required(int bins) const {
+  if (bins <= 1) {
+    return min_particles;
+  }
+  // Wilson-Hilferty approximation of the chi-square quantile with bins - 1 degrees of freedom
+  double k = bins - 1;
+  double a = 2. / (9 * k);
+  double n = k / (2 * epsilon) * pow(1 - a + sqrt(a) * z, 3);
+  return std::max(min_particles, int(std::min(n, double(max_particles))));
+}
+
+bool KLDSampler::buildAliasTable(const double *weights, int n) {
+  double total = 0;
+  for (int i = 0; i < n; i++) {
+    total += weights[i];
+  }
+  if (!(total > 0)) {
+    return false;
+  }
+  probability.resize(n);
+  alias.resize(n);
+  small.clear();
+  large.clear();
+  for (int i = 0; i < n; i++) {
+    probability[i] = weights[i] * n / total;
+    alias[i] = i;
+    if (probability[i] < 1) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+  // Fill up each small column with the excess of a large one
+  while (!small.empty() && !large.empty()) {
+    int s = small.back();
+    int l = large.back();
+    small.pop_back();
+    alias[s] = l;
+    probability[l] -= 1 - probability[s];
+    if (probability[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // What is left is 1 up to rounding errors
+  for (auto it = large.begin(); it != large.end(); it++) {
+    probability[*it] = 1;
+  }
+  for (auto it = small.begin(); it != small.end(); it++) {
+    probability[*it] = 1;
+  }
+  return true;
+}
+
+uint64_t KLDSampler::binKey(double x, double y, double theta) const {
+  // Wrap the yaw to [0, 2 PI) so equal headings share bins
+  theta = fmod(theta, 2 * M_PI);
+  if (theta < 0) {
+    theta += 2 * M_PI;
+  }
+  uint64_t bx = uint64_t(int64_t(floor(x / bin_x))) & 0x1FFFFF;
+  uint64_t by = uint64_t(int64_t(floor(y / bin_y))) & 0x1FFFFF;
+  uint64_t bt = uint64_t(int64_t(floor(theta / bin_theta))) & 0x1FFFFF;
+  return bx | (by << 21) | (bt << 42);
+}
+
+bool KLDSampler::occupy(uint64_t key) {
+  size_t mask = bin_keys.size() - 1;
+  // Fibonacci hashing of the key
+  size_t slot = size_t((key * 0x9E3779B97F4A7C15ULL) >> 20) & mask;
+  while (bin_stamps[slot] == stamp) {
+    if (bin_keys[slot] == key) {
+      return false;
+    }
+    slot = (slot + 1) & mask;
+  }
+  bin_stamps[slot] = stamp;
+  bin_keys[slot] = key;
+  return true;
+}
+
+int KLDSampler::resample(const ParticleSet &particles, Philox::Stream &random, std::vector<int> &ancestors,
+                         int limit) {
+  int n = particles.size();
+  int most = limit > 0? std::min(limit, max_particles): max_particles;
+  int least = std::min(min_particles, most);
+  ancestors.resize(most);
+  if (!buildAliasTable(particles.weight.data(), n)) { // nothing to go by, keep the particles
+    int count = std::max(least, std::min(n, most));
+    for (int i = 0; i < count; i++) {
+      ancestors[i] = i % n;
+    }
+    return count;
+  }
+
+  // At most max_particles bins can be occupied, keep the table at most half full
+  size_t slots = 1;
+  while (slots < 2 * size_t(max_particles)) {
+    slots <<= 1;
+  }
+  if (bin_keys.size() != slots) {
+    bin_keys.assign(slots, 0);
+    bin_stamps.assign(slots, 0);
+    stamp = 0;
+  }
+  if (++stamp == 0) { // wrapped around, forget old stamps
+    std::fill(bin_stamps.begin(), bin_stamps.end(), 0);
+    stamp = 1;
+  }
+
+  int bins = 0;
+  int needed = least;
+  int count = 0;
+  while (count < most && (count < needed || count < least)) {
+    int column = std::min(n - 1, int(Philox::uniform(random()) * n));
+    int ancestor = Philox::uniform(random()) < probability[column]? column: alias[column];
+    ancestors[count++] = ancestor;
+    if (occupy(binKey(particles.x[ancestor], particles.y[ancestor], particles.theta[ancestor]))) {
+      needed = required(++bins);
+    }
+  }
+  return count;
+}
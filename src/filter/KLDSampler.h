@@ -0,0 +1,113 @@
+#ifndef _FILTER_KLDSAMPLER_H_
+#define _FILTER_KLDSAMPLER_H_
+#include <stdint.h>
+#include <vector>
+#include "ParticleSet.h"
+#include "../utils/Philox.h"
+
+/**
+ * Adapts the number of particles with KLD-sampling (Fox, "Adapting the Sample Size in Particle Filters
+ * Through KLD-Sampling"). Ancestors are drawn one at a time, and the (x, y, yaw) bins they fall into are
+ * counted. Drawing stops once there are enough particles for the Kullback-Leibler divergence between the
+ * sample-based and the true posterior to stay below epsilon with probability 1 - delta, given the number
+ * of occupied bins. A well localized posterior occupies few bins and needs few particles.
+ */
+class KLDSampler {
+  private:
+    // Maximum KL divergence
+    double epsilon = 0.05;
+
+    // Upper 1 - delta quantile of the standard normal distribution
+    double z = 2.326;
+
+    // Bounds of the number of particles, a maximum of 0 disables KLD-sampling
+    int min_particles = 0;
+    int max_particles = 0;
+
+    // Bin sizes
+    double bin_x = 0.5;
+    double bin_y = 0.5;
+    double bin_theta = 0.1;
+
+    // Walker alias table of the weights, each column holds its own probability and an alias
+    std::vector<double> probability;
+    std::vector<int> alias;
+    std::vector<int> small;
+    std::vector<int> large;
+
+    // Occupied bins, an open addressing hash table of bin keys. A slot is occupied when its stamp is the
+    // current stamp, so the table does not need to be cleared between frames.
+    std::vector<uint64_t> bin_keys;
+    std::vector<uint32_t> bin_stamps;
+    uint32_t stamp = 0;
+
+    /**
+     * Build the alias table
+     * @param weights the weights
+     * @param n the number of weights
+     * @return false if the weights sum to 0
+     */
+    bool buildAliasTable(const double *weights, int n);
+
+    /**
+     * Mark a bin occupied
+     * @param key the bin's key
+     * @return true if the bin was not occupied before
+     */
+    bool occupy(uint64_t key);
+
+    /**
+     * Get the key of the bin of a particle
+     */
+    uint64_t binKey(double x, double y, double theta) const;
+
+  public:
+    /**
+     * Create a disabled sampler
+     */
+    KLDSampler() {}
+
+    /**
+     * Create a sampler
+     * @param epsilon the maximum KL divergence
+     * @param min_particles the minimum number of particles
+     * @param max_particles the maximum number of particles
+     * @param z the upper 1 - delta quantile of the standard normal distribution, 2.326 for delta = 0.01
+     */
+    KLDSampler(double epsilon, int min_particles, int max_particles, double z = 2.326);
+
+    /**
+     * Set the bin sizes
+     * @param x the x size [m]
+     * @param y the y size [m]
+     * @param theta the yaw size [rad]
+     */
+    void setBinSize(double x, double y, double theta);
+
+    /**
+     * @return true if KLD-sampling is enabled
+     */
+    bool enabled() const {
+      return max_particles > 0;
+    }
+
+    /**
+     * Get the number of particles needed for the given number of occupied bins
+     * @param bins the number of occupied bins
+     */
+    int required(int bins) const;
+
+    /**
+     * Draw ancestors in proportion to the particles' weights until there are enough of them for the
+     * occupied bins. Ancestors are drawn independently, like multinomial resampling.
+     * @param particles the particles
+     * @param random the random numbers
+     * @param ancestors receives the ancestors
+     * @param limit if positive, lowers the maximum number of particles for this draw
+     * @return the number of ancestors drawn
+     */
+    int resample(const ParticleSet &particles, Philox::Stream &random, std::vector<int> &ancestors,
+                 int limit = 0);
+};
+
+#endif
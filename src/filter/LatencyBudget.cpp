@@ -0,0 +1,55 @@
+/*
+ * LatencyBudget.cpp
+ *
+ * Per-frame time budgeting of the particle count and the observations used.
+ */
+
+#include <algorithm>
+#include "LatencyBudget.h"
+
+LatencyBudget::LatencyBudget(double deadline, int min_particles, int max_particles) :
+    deadline(deadline / 1000), min_particles(min_particles), max_particles(max_particles),
+    particles(max_particles) {}
+
+void LatencyBudget::record(Stage stage, Clock::time_point start, int particles, int observations) {
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  spent += elapsed;
+  int units = stage == UPDATE? particles * std::max(observations, 1): particles;
+  if (units > 0) {
+    smooth(cost[stage], elapsed / units);
+  }
+}
+
+void LatencyBudget::endFrame(Clock::time_point start, int available) {
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  smooth(overhead, std::max(elapsed - spent, 0.));
+  spent = 0;
+  plan(available);
+}
+
+void LatencyBudget::plan(int available) {
+  double per_particle = cost[PREDICTION] + cost[RESAMPLING] + cost[UPDATE] * std::max(available, 1);
+  if (per_particle <= 0) { // nothing measured yet
+    return;
+  }
+  double budget = headroom * deadline - overhead;
+  // Grow at most twice per frame, so that a cost underestimated from a cheap frame can not blow the next
+  // deadline by much
+  int n = int(std::min(budget / per_particle, 2. * particles));
+  observations = -1;
+  if (n < min_particles) {
+    // Even the minimum number of particles does not fit, use as many observations as it can afford
+    n = min_particles;
+    if (cost[UPDATE] > 0) {
+      double per_observation = (budget / n - cost[PREDICTION] - cost[RESAMPLING]) / cost[UPDATE];
+      observations = std::max(1, int(std::min(per_observation, double(available))));
+    }
+  }
+  particles = std::min(n, max_particles);
+}
+
+double LatencyBudget::predicted(int available) const {
+  int used = plannedObservations(available);
+  double per_particle = cost[PREDICTION] + cost[RESAMPLING] + cost[UPDATE] * std::max(used, 1);
+  return (overhead + particles * per_particle) * 1000;
+}
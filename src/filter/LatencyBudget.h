@@ -0,0 +1,118 @@
+#ifndef _FILTER_LATENCYBUDGET_H_
+#define _FILTER_LATENCYBUDGET_H_
+#include <chrono>
+
+/**
+ * Keeps each frame within a deadline. The time taken by each stage of the filter is measured, and a cost
+ * model is fitted to it: the prediction and the resampling cost a fixed time per particle, the update a
+ * fixed time per particle and observation, and the rest of the frame a fixed time. The costs are smoothed
+ * with an exponentially weighted moving average. From the model, the budget plans how many particles, and
+ * if even the minimum number of particles does not fit, how many observations the next frame can afford.
+ */
+class LatencyBudget {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    // The timed stages of a frame
+    enum Stage { PREDICTION, UPDATE, RESAMPLING, STAGES };
+
+  private:
+    // The deadline [s], 0 disables the budget
+    double deadline = 0;
+
+    // Fraction of the deadline planned for, leaving headroom for jitter
+    double headroom = 0.8;
+
+    // Weight of a new measurement in the moving averages
+    double smoothing = 0.2;
+
+    // Bounds of the number of particles
+    int min_particles = 0;
+    int max_particles = 0;
+
+    // Smoothed cost per particle of each stage, per particle and observation for the update [s]
+    double cost[STAGES] = {0, 0, 0};
+
+    // Smoothed time spent outside of the stages in a frame [s]
+    double overhead = 0;
+
+    // Time spent in the stages in the current frame [s]
+    double spent = 0;
+
+    // Planned number of particles and observations, observations < 0 uses all of them
+    int particles = 0;
+    int observations = -1;
+
+    /**
+     * Update a moving average with a new measurement
+     */
+    void smooth(double &average, double value) const {
+      average = average > 0? average + smoothing * (value - average): value;
+    }
+
+    /**
+     * Plan the number of particles and observations of the next frame
+     * @param available the number of observations available in the last frame
+     */
+    void plan(int available);
+
+  public:
+    /**
+     * Create a disabled budget
+     */
+    LatencyBudget() {}
+
+    /**
+     * Create a budget
+     * @param deadline the deadline of a frame [ms]
+     * @param min_particles the minimum number of particles, observations are dropped below it
+     * @param max_particles the maximum number of particles
+     */
+    LatencyBudget(double deadline, int min_particles, int max_particles);
+
+    /**
+     * @return true if the budget is enabled
+     */
+    bool enabled() const {
+      return deadline > 0;
+    }
+
+    /**
+     * Record the time taken by a stage
+     * @param stage the stage
+     * @param start when the stage started, it ends now
+     * @param particles the number of particles processed
+     * @param observations the number of observations processed, for the update
+     */
+    void record(Stage stage, Clock::time_point start, int particles, int observations = 0);
+
+    /**
+     * Record the end of a frame, and plan the next one
+     * @param start when the frame started, it ends now
+     * @param available the number of observations available in the frame
+     */
+    void endFrame(Clock::time_point start, int available);
+
+    /**
+     * @return the planned number of particles, 0 if the budget is disabled
+     */
+    int plannedParticles() const {
+      return particles;
+    }
+
+    /**
+     * Get the number of observations to use
+     * @param available the number of observations available
+     */
+    int plannedObservations(int available) const {
+      return observations < 0 || observations > available? available: observations;
+    }
+
+    /**
+     * Get the predicted time of a frame with the planned numbers of particles and observations [ms]
+     * @param available the number of observations available
+     */
+    double predicted(int available) const;
+};
+
+#endif
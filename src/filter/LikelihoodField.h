@@ -0,0 +1,143 @@
+#ifndef _FILTER_LIKELIHOODFIELD_H_
+#define _FILTER_LIKELIHOODFIELD_H_
+#include <math.h>
+#include <vector>
+#include "../map/Partition2D.h"
+#include "../map/NearestRaster.h"
+#include "../utils/ThreadPool.h"
+
+/**
+ * Likelihood field measurement model (Thrun et al., Probabilistic Robotics, 6.4). The log-likelihood of an
+ * observation landing on a location only depends on the distance to the landmark nearest to the location, so
+ * it is precomputed over the world's bounding box. Weighting an observation is then a bilinear lookup and an
+ * add, whatever the number of landmarks. A NearestRaster of the same resolution keeps the nearest landmark
+ * of each location for the associations.
+ */
+template<typename T> class LikelihoodField {
+  private:
+    // The weights of the mixture of a measurement of the nearest landmark, and of a random measurement
+    // uniformly spread within the search distance, which bounds the penalty of an observation far from every
+    // landmark
+    static constexpr double Z_HIT = 0.95;
+    static constexpr double Z_RAND = 0.05;
+
+    // The nearest landmark of each raster cell
+    NearestRaster<T> nearest;
+
+    // The raster's origin, and cell size, the field is sampled at the cells' centers
+    float x0 = 0;
+    float y0 = 0;
+    float resolution = 1;
+
+    // The dimension of the raster
+    int dim_x = 0;
+    int dim_y = 0;
+
+    // The log-likelihood at each cell's center, row by row
+    std::vector<float> field;
+
+    // The log-likelihood of a location without a landmark within the search distance, or outside of the world,
+    // the lowest of the field
+    float floor_value = 0;
+
+  public:
+    LikelihoodField() {}
+
+    /**
+     * Build the field
+     * @param partition the partition holding the landmarks, it must outlive the field
+     * @param resolution the width and height of raster cells
+     * @param std_landmark[] Array of dimension 2 [Landmark measurement uncertainty [x [m], y [m]]]
+     * @param pool worker threads to build the field with, or NULL to build it on the calling thread
+     */
+    void build(const Partition2D<T> &partition, float resolution, const double std_landmark[],
+               ThreadPool *pool = NULL) {
+      nearest.build(partition, resolution, pool);
+      float x1, y1;
+      partition.bounds(x0, y0, x1, y1);
+      this->resolution = resolution;
+      dim_x = std::ceil((x1 - x0) / resolution);
+      dim_y = std::ceil((y1 - y0) / resolution);
+      // The same flattened Gaussian as ParticleFilter::updateWeights(), mixed with a random measurement.
+      // Locations without a landmark within the search distance get the likelihood of a landmark at the search
+      // distance along the narrower axis, below that of any location with a landmark, so that observations
+      // landing away from every landmark are penalized rather than rewarded, but by a bounded amount, so that
+      // a single stray observation does not zero a particle's weight.
+      double c1 = 0.5 / (M_PI * std_landmark[0] * std_landmark[1]);
+      double scale_x = 1. / (20 * square(std_landmark[0]));
+      double scale_y = 1. / (20 * square(std_landmark[1]));
+      double random = Z_RAND / (M_PI * square(partition.maxDistance()));
+      floor_value = log(Z_HIT * c1 * exp(-square(partition.maxDistance()) * std::max(scale_x, scale_y)) + random);
+      field.assign(long(dim_x) * dim_y, floor_value);
+      ThreadPool::Job fill = [&](int begin, int end, int part) {
+        std::vector<double> xs(dim_x);
+        std::vector<double> ys(dim_x);
+        std::vector<int> index(dim_x);
+        std::vector<double> distance(dim_x);
+        for (int j = begin; j < end; j++) {
+          for (int i = 0; i < dim_x; i++) {
+            xs[i] = x0 + (i + 0.5) * resolution;
+            ys[i] = y0 + (j + 0.5) * resolution;
+          }
+          nearest.findNearestBatch(xs.data(), ys.data(), dim_x, index.data(), distance.data());
+          float *row = &field[long(j) * dim_x];
+          for (int i = 0; i < dim_x; i++) {
+            int k = index[i];
+            if (k >= 0) {
+              row[i] = log(Z_HIT * c1 * exp(-square(xs[i] - nearest.pointX(k)) * scale_x
+                                            - square(ys[i] - nearest.pointY(k)) * scale_y) + random);
+            }
+          }
+        }
+      };
+      if (pool) {
+        pool->parallelFor(0, dim_y, fill);
+      } else {
+        fill(0, dim_y, 0);
+      }
+    }
+
+    /**
+     * @return the memory used by the field and its nearest landmark raster [bytes]
+     */
+    size_t memory() const {
+      return field.size() * sizeof(float) + nearest.memory();
+    }
+
+    /**
+     * Add the log-likelihoods of observations, interpolated bilinearly between the cells' centers. Observations
+     * outside of the world get the log-likelihood of a location without a landmark.
+     * @param x the observations' map x coordinates
+     * @param y the observations' map y coordinates
+     * @param n the number of observations
+     * @param log_likelihood the accumulated log-likelihoods
+     */
+    void accumulate(const double *x, const double *y, int n, double *log_likelihood) const {
+      for (int q = 0; q < n; q++) {
+        double u = (x[q] - x0) / resolution - 0.5;
+        double v = (y[q] - y0) / resolution - 0.5;
+        int i = std::floor(u);
+        int j = std::floor(v);
+        if (i < 0 || j < 0 || i >= dim_x - 1 || j >= dim_y - 1) {
+          log_likelihood[q] += floor_value;
+          continue;
+        }
+        double fu = u - i;
+        double fv = v - j;
+        const float *row0 = &field[long(j) * dim_x + i];
+        const float *row1 = row0 + dim_x;
+        double bottom = row0[0] + fu * (row0[1] - row0[0]);
+        double top = row1[0] + fu * (row1[1] - row1[0]);
+        log_likelihood[q] += bottom + fv * (top - bottom);
+      }
+    }
+
+    /**
+     * Get the nearest landmark raster, for the associations
+     */
+    const NearestRaster<T> &raster() const {
+      return nearest;
+    }
+};
+
+#endif
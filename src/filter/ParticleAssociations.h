@@ -0,0 +1,89 @@
+#ifndef _FILTER_PARTICLEASSOCIATIONS_H_
+#define _FILTER_PARTICLEASSOCIATIONS_H_
+#include <vector>
+
+/**
+ * Side storage of the landmark associations of all particles. Each particle owns a fixed row of stride
+ * slots in three flat arrays, so recording associations never allocates once the arrays have grown to
+ * the number of particles times the number of observations.
+ */
+class ParticleAssociations {
+  private:
+    // Maximum number of associations per particle
+    int stride = 0;
+
+    // Number of associations recorded for each particle
+    std::vector<int> counts;
+
+    // Associated landmark ids, and the observation's world coordinates
+    std::vector<int> ids;
+    std::vector<double> sense_x;
+    std::vector<double> sense_y;
+
+  public:
+    /**
+     * Drop all associations and make room for the given number of particles and observations
+     * @param particles the number of particles
+     * @param max_associations the maximum number of associations per particle
+     */
+    void reset(int particles, int max_associations) {
+      stride = max_associations;
+      counts.assign(particles, 0);
+      ids.resize(particles * stride);
+      sense_x.resize(particles * stride);
+      sense_y.resize(particles * stride);
+    }
+
+    /**
+     * Drop the associations of a particle
+     * @param particle the particle index
+     */
+    void clear(int particle) {
+      counts[particle] = 0;
+    }
+
+    /**
+     * Record an association
+     * @param particle the particle index
+     * @param id the landmark id
+     * @param x the observation's x coordinate in map coordinates
+     * @param y the observation's y coordinate in map coordinates
+     */
+    void add(int particle, int id, double x, double y) {
+      int slot = particle * stride + counts[particle]++;
+      ids[slot] = id;
+      sense_x[slot] = x;
+      sense_y[slot] = y;
+    }
+
+    /**
+     * @return the maximum number of associations per particle
+     */
+    int capacity() const {
+      return stride;
+    }
+
+    /**
+     * @return the number of particles covered
+     */
+    int size() const {
+      return counts.size();
+    }
+
+    /**
+     * Get the associations of a particle
+     * @param particle the particle index
+     * @param ids_out receives the landmark ids
+     * @param x_out receives the x coordinates
+     * @param y_out receives the y coordinates
+     */
+    void get(int particle, std::vector<int> &ids_out, std::vector<double> &x_out, std::vector<double> &y_out) const {
+      int n = counts[particle];
+      int slot = particle * stride;
+      ids_out.assign(ids.begin() + slot, ids.begin() + slot + n);
+      x_out.assign(sense_x.begin() + slot, sense_x.begin() + slot + n);
+      y_out.assign(sense_y.begin() + slot, sense_y.begin() + slot + n);
+    }
+};
+
+#endif
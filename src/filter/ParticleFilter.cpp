@@ -15,118 +15,319 @@
 #include <string>
 #include <tuple>
 #include "ParticleFilter.h"
+#include "ParticleKernels.h"
 
 using namespace std;
 
-std::default_random_engine ParticleFilter::generator;
+const int ParticleFilter::KERNEL_BLOCK;
 
 void ParticleFilter::init(double x, double y, double theta, double std[]) {
   // Initialize all particles to first position (based on estimates of
   //   x, y, theta and their uncertainties from GPS) and all weights to 1.
   // Add random Gaussian noise to each particle.
-  // Initialize the normal distribution for x, y, and theta
-  distribution_x = normal_distribution<double>(0, std[0]);
-  distribution_y = normal_distribution<double>(0, std[1]);
-  distribution_theta = normal_distribution<double>(0, std[2]);
+  std_pos[0] = std[0];
+  std_pos[1] = std[1];
+  std_pos[2] = std[2];
+  frame = 0;
+  particles.clear();
+  particles.reserve(num_particles);
   for (int i = 0; i < num_particles; i++) {
-		Particle p(
-								i,
-								x + distribution_x(generator), 
-								y + distribution_y(generator),
-								theta + distribution_theta(generator));
-    particles.push_back(p);
+    double noise[4];
+    random.normal(i, frame, INIT_STREAM, 0, noise);
+    particles.add(x + noise[0] * std_pos[0],
+                  y + noise[1] * std_pos[1],
+                  theta + noise[2] * std_pos[2]);
   }
+  associations.reset(num_particles, 0);
+  resetAssociationRows();
+  weights_uniform = true;
+  ess = num_particles;
   is_initialized = true;
 }
 
 void ParticleFilter::prediction(double delta_t, double velocity, double yaw_rate) {
-  // Add prediction to each particle and add random Gaussian noise.
-  for (int i = 0; i < num_particles; i++) {
-    Particle& particle = particles[i];
-    double new_yaw = particle.theta + yaw_rate * delta_t;
-    // We need to habdle the situation when yaw rate is 0
-    if (fabs(yaw_rate) > EPSILON) { // yaw rate is not 0
-      particle.x += velocity / yaw_rate * (sin(new_yaw) - sin(particle.theta)) +
-                    distribution_x(generator);
-      particle.y += velocity / yaw_rate * (cos(particle.theta) - cos(new_yaw)) +
-                    distribution_y(generator);
+  // Add prediction to each particle and add random Gaussian noise. Particles are processed in blocks, the
+  // noise of a block is drawn first, then the motion kernel advances the whole block at once. The noise of
+  // a particle only depends on its index and the frame, not on the thread drawing it.
+  LatencyBudget::Clock::time_point start = LatencyBudget::Clock::now();
+  frame++;
+  parallelFor([&](int begin, int end, int part) {
+    double u0[KERNEL_BLOCK];
+    double u1[KERNEL_BLOCK];
+    double u2[KERNEL_BLOCK];
+    double u3[KERNEL_BLOCK];
+    double noise_x[KERNEL_BLOCK];
+    double noise_y[KERNEL_BLOCK];
+    double noise_theta[KERNEL_BLOCK];
+    double unused[KERNEL_BLOCK];
+    for (int i = begin; i < end; i += KERNEL_BLOCK) {
+      int n = std::min(KERNEL_BLOCK, end - i);
+      for (int j = 0; j < n; j++) {
+        uint32_t words[4];
+        random.generate(i + j, frame, MOTION_STREAM, 0, words);
+        u0[j] = Philox::uniform(words[0]);
+        u1[j] = Philox::uniform(words[1]);
+        u2[j] = Philox::uniform(words[2]);
+        u3[j] = Philox::uniform(words[3]);
+      }
+      ParticleKernels::gaussian(u0, u1, n, std_pos[0], std_pos[1], noise_x, noise_y);
+      ParticleKernels::gaussian(u2, u3, n, std_pos[2], 0, noise_theta, unused);
+      ParticleKernels::predict(&particles.x[i], &particles.y[i], &particles.theta[i], noise_x, noise_y,
+                               noise_theta, n, delta_t, velocity, yaw_rate);
     }
-    else { // yaw rate is 0
-      particle.x += velocity * cos(particle.theta) + distribution_x(generator);
-      particle.y += velocity * sin(particle.theta) + distribution_y(generator);
+  });
+  budget.record(LatencyBudget::PREDICTION, start, num_particles);
+}
+
+void ParticleFilter::updateWeights(double sensor_range, const std::vector<LandmarkObs>& observed,
+                                   const LikelihoodField<Map::single_landmark_s>& field) {
+  // Sum up the log-likelihoods of the observations looked up in the field, the weight then takes one exp per
+  // particle. The associations still come from the field's nearest landmark raster. An observation without
+  // a landmark nearby lowers the weight rather than being skipped.
+  LatencyBudget::Clock::time_point start = LatencyBudget::Clock::now();
+  const std::vector<LandmarkObs>& observations = selectObservations(observed);
+  associations.reset(num_particles, observations.size());
+  resetAssociationRows();
+  const double* px = particles.x.data();
+  const double* py = particles.y.data();
+  const NearestRaster<Map::single_landmark_s>& raster = field.raster();
+  double range2 = square(sensor_range);
+  log_weights.resize(num_particles);
+  std::vector<double> part_max(parts(), -HUGE_VAL);
+  parallelFor([&](int begin, int end, int part) {
+    double sin_theta[KERNEL_BLOCK];
+    double cos_theta[KERNEL_BLOCK];
+    double obs_x[KERNEL_BLOCK];
+    double obs_y[KERNEL_BLOCK];
+    int nearest[KERNEL_BLOCK];
+    double distance[KERNEL_BLOCK];
+    int candidates[KERNEL_BLOCK];
+    long part_searches = 0;
+    long part_searched = 0;
+    for (int i = begin; i < end; i += KERNEL_BLOCK) {
+      int n = std::min(KERNEL_BLOCK, end - i);
+      double* log_likelihood = &log_weights[i];
+      ParticleKernels::sincos(&particles.theta[i], sin_theta, cos_theta, n);
+      std::fill(log_likelihood, log_likelihood + n, 0.);
+      for (auto it = observations.begin(); it != observations.end(); it++) {
+        ParticleKernels::transform(px + i, py + i, sin_theta, cos_theta, n, it->x, it->y, obs_x, obs_y);
+        field.accumulate(obs_x, obs_y, n, log_likelihood);
+        raster.findNearestBatch(obs_x, obs_y, n, nearest, distance, candidates);
+        for (int j = 0; j < n; j++) {
+          part_searches++;
+          int k = nearest[j];
+          if (k >= 0 && dist2(px[i + j], py[i + j], raster.pointX(k), raster.pointY(k)) < range2) {
+            part_searched += candidates[j];
+            associations.add(i + j, raster.object(k)->id(), obs_x[j], obs_y[j]);
+          }
+        }
+      }
+      part_max[part] = std::max(part_max[part], *std::max_element(log_likelihood, log_likelihood + n));
     }
-    
-    particle.theta = new_yaw + distribution_theta(generator);
+    searches += part_searches;
+    searched += part_searched;
+  });
+
+  // Subtract the largest log-likelihood before the exp, so that the best particle's likelihood is 1 rather
+  // than underflowing to 0 with many observations, the normalization cancels the factor
+  double max_log_likelihood = *std::max_element(part_max.begin(), part_max.end());
+  parallelFor([&](int begin, int end, int part) {
+    double exponent[KERNEL_BLOCK];
+    double count[KERNEL_BLOCK];
+    double likelihood[KERNEL_BLOCK];
+    std::fill(count, count + KERNEL_BLOCK, 0.);
+    for (int i = begin; i < end; i += KERNEL_BLOCK) {
+      int n = std::min(KERNEL_BLOCK, end - i);
+      // weight = exp(0 * log_c - (max - log_likelihood))
+      for (int j = 0; j < n; j++) {
+        exponent[j] = max_log_likelihood - log_weights[i + j];
+      }
+      ParticleKernels::likelihood(exponent, count, n, 0, likelihood);
+      double* weight = &particles.weight[i];
+      if (weights_uniform) {
+        std::copy(likelihood, likelihood + n, weight);
+      } else {
+        for (int j = 0; j < n; j++) {
+          weight[j] *= likelihood[j];
+        }
+      }
+    }
+  });
+  weights_uniform = false;
+  normalizeWeights();
+  budget.record(LatencyBudget::UPDATE, start, num_particles, observations.size());
+}
+
+const std::vector<LandmarkObs>& ParticleFilter::selectObservations(const std::vector<LandmarkObs>& observations) {
+  int count = budget.plannedObservations(observations.size());
+  if (count == int(observations.size())) {
+    return observations;
   }
+  // The closer a landmark, the less the yaw error displaces its observation
+  selected = observations;
+  std::nth_element(selected.begin(), selected.begin() + count, selected.end(),
+                   [](const LandmarkObs& a, const LandmarkObs& b) {
+                     return square(a.x) + square(a.y) < square(b.x) + square(b.y);
+                   });
+  selected.resize(count);
+  return selected;
 }
 
-void ParticleFilter::updateWeights(
-    double sensor_range, double std_landmark[],
-    const std::vector<LandmarkObs>& observations,
-    const Partition2D<Map::single_landmark_s>& partition) {
-  // Update the weights of each particle using a mult-variate Gaussian
-  weights.clear();
-  for (int i = 0; i < num_particles; i++) {
-		Particle& particle = particles[i];
-		particle.associations.clear();
-		particle.sense_x.clear();
-		particle.sense_y.clear();
-    double sin_theta = sin(particle.theta);
-    double cos_theta = cos(particle.theta);
-    double weight = 1.;
-    double c1 = 0.5/(M_PI*std_landmark[0]*std_landmark[1]);
-    for (auto it = observations.begin();
-         it != observations.end(); it++) {
-      const LandmarkObs& obs = *it;
-#ifdef VERBOSE_OUT
-      std::cout << "Search:" << particle.id << " (" << particle.x << "," << particle.y << "," << particle.theta << ")" 
-                << "(" << obs.x << "," << obs.y << ")"<< std::endl;
-#endif
-
-      // Transform observation coordinate to map coordinate
-      double x = particle.x + obs.x * cos_theta - obs.y * sin_theta;
-      double y = particle.y + obs.x * sin_theta + obs.y * cos_theta;
-      Map::single_landmark_s* nearest;
-      double distance;
-      int searched;
-      searches++;
-      std::tie(nearest, distance, searched) = partition.findNearest(x, y);
-      if (nearest && dist(particle.x, particle.y, nearest->x(), nearest->y()) < sensor_range) {  // we have found one
-        this->searched += searched;
-#ifdef VERBOSE_OUT
-        std::cout << "Found " << nearest->id() << "(" << nearest->x() << "," << nearest->y() << "), distance: " 
-                  << dist << ", searched: " << searched << std::endl;
-#endif
-        double dx = x - nearest->x();
-        double dy = y - nearest->y();
-        // Compute the probability according to the distance deviation between the nearest landmark and the
-        // particle's "observation". However, when there is a bigger deviation, the probability may become
-        // very low, and results in 0 weights for all particles. When this happen, the filter will not
-        // be able to produce useful result. To avoid this problem, we flatten the distribution by an order
-        // of magnitude - by dividing the exponent by 10. This is fine since weights are relative.
-        double p = c1 / exp((square(dx/std_landmark[0]) + square(dy/std_landmark[1]))/20);
-				weight *= p;
-				particle.associations.push_back(nearest->id());
-				particle.sense_x.push_back(x);
-				particle.sense_y.push_back(y);
+void ParticleFilter::normalizeWeights() {
+  // The sums are reduced over fixed blocks of particles, then the blocks are added in order, so the rounding
+  // and thus the resampling do not depend on the number of threads
+  int blocks = (num_particles + KERNEL_BLOCK - 1) / KERNEL_BLOCK;
+  std::vector<double> block_sum(blocks, 0.);
+  double* pweight = particles.weight.data();
+  parallelFor(blocks, [&](int begin, int end, int part) {
+    for (int b = begin; b < end; b++) {
+      double sum = 0;
+      for (int i = b * KERNEL_BLOCK; i < std::min(num_particles, (b + 1) * KERNEL_BLOCK); i++) {
+        sum += pweight[i];
       }
+      block_sum[b] = sum;
     }
-    particle.weight = weight;
-    weights.push_back(weight);
-  }
+  });
+  double total = std::accumulate(block_sum.begin(), block_sum.end(), 0.);
+  // When all weights are 0 we know nothing about the particles, start over with uniform weights
+  double scale = total > 0? 1 / total: 0;
+  double uniform = total > 0? 0: 1. / num_particles;
+  parallelFor(blocks, [&](int begin, int end, int part) {
+    for (int b = begin; b < end; b++) {
+      double sum = 0;
+      for (int i = b * KERNEL_BLOCK; i < std::min(num_particles, (b + 1) * KERNEL_BLOCK); i++) {
+        pweight[i] = pweight[i] * scale + uniform;
+        sum += pweight[i] * pweight[i];
+      }
+      block_sum[b] = sum;
+    }
+  });
+  ess = 1 / std::accumulate(block_sum.begin(), block_sum.end(), 0.);
 }
 
 void ParticleFilter::resample() {
   // Resample particles with replacement with probability proportional to
-  // their weight.
-	std::discrete_distribution<> distribution(weights.begin(), weights.end());
-	std::vector<Particle> samples;
-	for (int i = 0; i < num_particles; i++) {
-		int rand = distribution(generator);
-		samples.push_back(particles[rand]);
-	}
-	particles.clear();
-	particles = samples;
+  // their weight. The particles are only resampled when the effective sample size is low enough, otherwise
+  // their weights are carried over to the next update. The ancestors are drawn first, then the poses of the
+  // ancestors are gathered into the back buffer which becomes the new set of particles. Associations stay
+  // where they are, each particle just refers to the association row of its ancestor. The latency budget
+  // forces resampling when it can not afford the current number of particles.
+  int count = budget.enabled()? budget.plannedParticles(): num_particles;
+  if (resampling_threshold < 1 && ess >= resampling_threshold * num_particles && count >= num_particles) {
+    return;
+  }
+  LatencyBudget::Clock::time_point start = LatencyBudget::Clock::now();
+  Philox::Stream generator(random, frame, RESAMPLE_STREAM);
+  if (kld.enabled()) {
+    count = kld.resample(particles, generator, ancestors, budget.enabled()? count: 0);
+  } else {
+    ancestors.resize(count);
+    resampler.resample(particles.weight.data(), num_particles, count, generator, ancestors.data());
+  }
+  spare.resize(count);
+  spare_rows.resize(count);
+  parallelFor(count, [&](int begin, int end, int part) {
+    for (int i = begin; i < end; i++) {
+      spare.copy(i, particles, ancestors[i]);
+      spare_rows[i] = association_rows[ancestors[i]];
+    }
+  });
+  particles.swap(spare);
+  association_rows.swap(spare_rows);
+  num_particles = count;
+  weights_uniform = true;
+  budget.record(LatencyBudget::RESAMPLING, start, num_particles);
+}
+
+int ParticleFilter::best(double *weight_sum) const {
+  // Each part finds its own best particle and weight sum, then the parts are combined
+  std::vector<int> part_best(parts(), 0);
+  std::vector<double> part_sum(parts(), 0.);
+  const double* pweight = particles.weight.data();
+  parallelFor([&](int begin, int end, int part) {
+    int best = begin;
+    double sum = 0;
+    for (int i = begin; i < end; i++) {
+      if (pweight[i] > pweight[best]) {
+        best = i;
+      }
+      sum += pweight[i];
+    }
+    part_best[part] = best;
+    part_sum[part] = sum;
+  });
+  int best = part_best[0];
+  double sum = part_sum[0];
+  for (int i = 1; i < parts(); i++) {
+    if (pweight[part_best[i]] > pweight[best]) {
+      best = part_best[i];
+    }
+    sum += part_sum[i];
+  }
+  if (weight_sum) {
+    *weight_sum = sum;
+  }
+  return best;
+}
+
+void ParticleFilter::bounds(double &x0, double &y0, double &x1, double &y1) const {
+  // Each part finds the bounding box of its particles, then the boxes are combined
+  std::vector<double> part_box(parts() * 4);
+  for (int i = 0; i < parts(); i++) {
+    part_box[i * 4] = part_box[i * 4 + 1] = 1.E20;
+    part_box[i * 4 + 2] = part_box[i * 4 + 3] = -1.E20;
+  }
+  parallelFor([&](int begin, int end, int part) {
+    double *box = &part_box[part * 4];
+    for (int i = begin; i < end; i++) {
+      box[0] = std::min(box[0], particles.x[i]);
+      box[1] = std::min(box[1], particles.y[i]);
+      box[2] = std::max(box[2], particles.x[i]);
+      box[3] = std::max(box[3], particles.y[i]);
+    }
+  });
+  x0 = y0 = 1.E20;
+  x1 = y1 = -1.E20;
+  for (int i = 0; i < parts(); i++) {
+    x0 = std::min(x0, part_box[i * 4]);
+    y0 = std::min(y0, part_box[i * 4 + 1]);
+    x1 = std::max(x1, part_box[i * 4 + 2]);
+    y1 = std::max(y1, part_box[i * 4 + 3]);
+  }
+}
+
+const Partition2D<Map::single_landmark_s>& ParticleFilter::localPartition(
+    const Partition2D<Map::single_landmark_s>& global, double margin) {
+  double x0, y0, x1, y1;
+  bounds(x0, y0, x1, y1);
+  x0 -= margin;
+  y0 -= margin;
+  x1 += margin;
+  y1 += margin;
+  local.copyRegion(global, x0, y0, x1, y1);
+  return local;
+}
+
+void ParticleFilter::parallelFor(int n, const ThreadPool::Job &job) const {
+  if (pool) {
+    pool->parallelFor(0, n, job);
+  } else if (n > 0) {
+    job(0, n, 0);
+  }
+}
+
+void ParticleFilter::resetAssociationRows() {
+  association_rows.resize(num_particles);
+  for (int i = 0; i < num_particles; i++) {
+    association_rows[i] = i;
+  }
+}
+
+Particle ParticleFilter::getParticle(int index) const {
+  Particle particle(index, particles.x[index], particles.y[index], particles.theta[index],
+                    particles.weight[index]);
+  associations.get(association_rows[index], particle.associations, particle.sense_x, particle.sense_y);
+  return particle;
 }
 
 Particle ParticleFilter::SetAssociations(Particle particle,
@@ -11,11 +11,29 @@
 
 //#define VERBOSE_OUT
 
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
 #include <random>
 #include "../utils/helper_functions.h"
+#include "../utils/Philox.h"
+#include "../utils/ThreadPool.h"
 #include "../map/Map.h"
 #include "../map/Partition2D.h"
+#include "../map/LandmarkIndex.h"
+#include "ParticleSet.h"
+#include "ParticleAssociations.h"
+#include "Resampler.h"
+#include "KLDSampler.h"
+#include "LatencyBudget.h"
+#include "ParticleKernels.h"
+#include "LikelihoodField.h"
 
+/**
+ * A single particle along with its associations, as assembled by ParticleFilter::getParticle(). The
+ * filter itself keeps its particles in a ParticleSet.
+ */
 struct Particle {
 	int id;
 	double x;
@@ -44,33 +62,84 @@ struct Particle {
 };
 
 class ParticleFilter {
-	// Random number generator
-	static std::default_random_engine generator;
+	// Number of particles processed together by the particle kernels
+	static const int KERNEL_BLOCK = 256;
+
+	// Streams of random numbers, the counter of a random number is (particle, frame, stream, 0)
+	enum RandomStream { INIT_STREAM, MOTION_STREAM, RESAMPLE_STREAM };
+
+	// Counter-based random number generator, each particle draws its own numbers from it
+	Philox random;
+
+	// Number of frames processed, part of the counters of the random numbers
+	uint32_t frame = 0;
 
 	// Number of particles to draw
 	int num_particles; 
 	
 	// Flag, if filter is initialized
 	bool is_initialized;
+
+	// Worker threads to process particles in parallel, or NULL to process them on the calling thread
+	ThreadPool *pool;
 	
-	int searches = 0;
-	int searched = 0;
+	std::atomic<long> searches;
+	std::atomic<long> searched;
+
+	// Poses and weights of the particles
+	ParticleSet particles;
+
+	// Back buffer the particles are resampled into, then swapped with particles
+	ParticleSet spare;
+
+	// Landmark associations recorded by the last weight update
+	ParticleAssociations associations;
+
+	// The row in associations of each particle, resampling only updates these instead of copying associations
+	std::vector<int> association_rows;
+	std::vector<int> spare_rows;
+
+	// Draws the ancestors of the resampled particles
+	Resampler resampler;
+
+	// Adapts the number of particles when resampling, if enabled
+	KLDSampler kld;
+
+	// The ancestor of each resampled particle
+	std::vector<int> ancestors;
 
-	// Vector of weights of all particles
-	std::vector<double> weights;
+	// Resample only when the effective sample size drops below this fraction of the number of particles,
+	// 1 resamples every frame
+	double resampling_threshold = 1;
 
-	// Random distributions
-  std::normal_distribution<double> distribution_x;
-  std::normal_distribution<double> distribution_y;
-  std::normal_distribution<double> distribution_theta;
+	// Effective sample size of the normalized weights of the last update
+	double ess = 0;
+
+	// Whether the particles were resampled since the last update, their prior weights are then uniform
+	bool weights_uniform = true;
+
+	// Adapts the number of particles and observations to a deadline, if enabled
+	LatencyBudget budget;
+
+	// The observations used when the budget can not afford all of them
+	std::vector<LandmarkObs> selected;
+
+	// The log-likelihood of each particle's observations, for the likelihood field model
+	std::vector<double> log_weights;
+
+	// The landmarks around the particles, see localPartition()
+	Partition2D<Map::single_landmark_s> local;
+
+	// Standard deviations of the x, y, and yaw noise
+	double std_pos[3];
 	
 public:
-	// Set of current particles
-	std::vector<Particle> particles;
-
 	// Constructor
 	// @param nParticles Number of particles
-	ParticleFilter(int nParticles) : num_particles(nParticles), is_initialized(false) {}
+	// @param pool Worker threads to process particles in parallel, or NULL to process them on the calling thread
+	// @param seed Seed of the random numbers, filters with different seeds draw independent numbers
+	ParticleFilter(int nParticles, ThreadPool *pool = NULL, uint64_t seed = 0) :
+		random(seed), num_particles(nParticles), is_initialized(false), pool(pool), searches(0), searched(0) {}
 
 	// Destructor
 	~ParticleFilter() {}
@@ -97,21 +166,92 @@ public:
 	
 	/**
 	 * updateWeights Updates the weights for each particle based on the likelihood of the 
-	 *   observed measurements. 
+	 *   observed measurements. The weights are normalized, and the effective sample size is computed.
 	 * @param sensor_range Range [m] of sensor
 	 * @param std_landmark[] Array of dimension 2 [Landmark measurement uncertainty [x [m], y [m]]]
 	 * @param observations Vector of landmark observations
-	 * @param partition Partition2D class containing a space partition for the landmarks
+	 * @param index Landmark index used to find the landmark nearest to each observation, such as Partition2D or
+	 *   KDTree2D, see LandmarkIndex
 	 */
-	void updateWeights(double sensor_range, double std_landmark[], const std::vector<LandmarkObs> &observations,
-			const Partition2D<Map::single_landmark_s> &partition);
+	template<typename Index> void updateWeights(double sensor_range, double std_landmark[],
+			const std::vector<LandmarkObs> &observations, const Index &index);
 	
+	/**
+	 * updateWeights Updates the weights with the likelihood field measurement model, each observation is
+	 *   weighted by a lookup in the precomputed field instead of searching for its nearest landmark.
+	 * @param sensor_range Range [m] of sensor, only used for the associations
+	 * @param observations Vector of landmark observations
+	 * @param field Likelihood field of the map, built with the landmark measurement uncertainty
+	 */
+	void updateWeights(double sensor_range, const std::vector<LandmarkObs> &observations,
+			const LikelihoodField<Map::single_landmark_s> &field);
+
 	/**
 	 * resample Resamples from the updated set of particles to form
 	 *   the new set of particles.
 	 */
 	void resample();
 
+	/**
+	 * Resample only when the effective sample size drops below a fraction of the number of particles.
+	 * Otherwise the particles are kept, and their normalized weights are carried over to the next update.
+	 * @param threshold the fraction, in (0, 1], 1 (the default) resamples every frame
+	 */
+	void setResamplingThreshold(double threshold) {
+		resampling_threshold = threshold;
+	}
+
+	/**
+	 * Get the effective sample size, 1 / sum(w^2) of the normalized weights of the last update
+	 */
+	double effectiveSampleSize() const {
+		return ess;
+	}
+
+	/**
+	 * Adapt the number of particles with KLD-sampling when resampling. The resampling strategy is then
+	 * ignored, ancestors are drawn independently.
+	 * @param sampler the KLD-sampling settings
+	 */
+	void setKLDSampler(const KLDSampler &sampler) {
+		kld = sampler;
+	}
+
+	/**
+	 * Keep frames within a deadline by adapting the number of particles when resampling, and the number of
+	 * observations used by the update, closest observations first
+	 * @param latency the latency budget
+	 */
+	void setLatencyBudget(const LatencyBudget &latency) {
+		budget = latency;
+	}
+
+	/**
+	 * Get the latency budget
+	 */
+	const LatencyBudget &getLatencyBudget() const {
+		return budget;
+	}
+
+	/**
+	 * Record the end of a frame, so that the latency budget accounts for the time spent outside the filter
+	 * @param start when the frame started
+	 * @param observations the number of observations of the frame
+	 */
+	void endFrame(LatencyBudget::Clock::time_point start, int observations) {
+		if (budget.enabled()) {
+			budget.endFrame(start, observations);
+		}
+	}
+
+	/**
+	 * Set the resampling strategy, multinomial by default
+	 * @param strategy the strategy
+	 */
+	void setResamplingStrategy(Resampler::Strategy strategy) {
+		resampler.setStrategy(strategy);
+	}
+
 	/*
 	 * Set a particles list of associations, along with the associations calculated world x,y coordinates
 	 * This can be a very useful debugging tool to make sure transformations are correct and assocations correctly connected
@@ -122,6 +262,47 @@ public:
 	std::string getSenseX(Particle best);
 	std::string getSenseY(Particle best);
 
+	/**
+	 * Get the current particles
+	 */
+	const ParticleSet &getParticles() const {
+		return particles;
+	}
+
+	/**
+	 * Get the bounding box of the particles
+	 * @param x0 receives the smallest x coordinate
+	 * @param y0 receives the smallest y coordinate
+	 * @param x1 receives the largest x coordinate
+	 * @param y1 receives the largest y coordinate
+	 */
+	void bounds(double &x0, double &y0, double &x1, double &y1) const;
+
+	/**
+	 * Build a partition of the landmarks around the particles, the global partition's cells within a margin of
+	 * the particles' bounding box, reusing the storage of the last frame's. The particles are close together,
+	 * so it holds a handful of landmarks that stay in cache while the update searches them.
+	 * @param global the partition of the whole map
+	 * @param margin the margin [m], the sensor range plus the global partition's search distance, so that the
+	 *   local partition holds every landmark the global search could find for an observation
+	 * @return the local partition, valid until the next call
+	 */
+	const Partition2D<Map::single_landmark_s> &localPartition(const Partition2D<Map::single_landmark_s> &global,
+			double margin);
+
+	/**
+	 * Find the particle with the highest weight
+	 * @param weight_sum if not NULL, receives the sum of the weights of all particles
+	 * @return the index of the best particle
+	 */
+	int best(double *weight_sum = NULL) const;
+
+	/**
+	 * Get a particle along with its associations
+	 * @param index the index of the particle
+	 */
+	Particle getParticle(int index) const;
+
 	/**
 	 * initialized Returns whether particle filter is initialized yet or not.
 	 */
@@ -129,6 +310,47 @@ public:
 		return is_initialized;
 	}
 
+private:
+	/**
+	 * Normalize the weights, and compute the effective sample size
+	 */
+	void normalizeWeights();
+
+	/**
+	 * Select the observations the latency budget can afford, the closest ones to the vehicle
+	 * @param observations all observations
+	 * @return observations, or the selected ones
+	 */
+	const std::vector<LandmarkObs> &selectObservations(const std::vector<LandmarkObs> &observations);
+
+	/**
+	 * Make each particle refer to its own association row
+	 */
+	void resetAssociationRows();
+
+	/**
+	 * Run a job over a range of particles, split into one part per thread of the pool
+	 * @param n the number of particles
+	 * @param job the job to run on each part
+	 */
+	void parallelFor(int n, const ThreadPool::Job &job) const;
+
+	/**
+	 * Run a job over all particles, split into one part per thread of the pool
+	 * @param job the job to run on each part
+	 */
+	void parallelFor(const ThreadPool::Job &job) const {
+		parallelFor(num_particles, job);
+	}
+
+	/**
+	 * @return the number of parts the particles are split into
+	 */
+	int parts() const {
+		return pool? pool->size(): 1;
+	}
+
+public:
 	float averageSearch() {
 		if (searches) {
 			return float(searched) / searches;
@@ -138,5 +360,103 @@ public:
 };
 
 
+// The weight update is a template over the landmark index, so it lives in the header
+template<typename Index> void ParticleFilter::updateWeights(
+    double sensor_range, double std_landmark[],
+    const std::vector<LandmarkObs>& observed,
+    const Index& index) {
+  static_assert(LandmarkIndex<Index>::value, "Index must provide findNearestBatch(), object(), pointX(), and "
+                "pointY() like Partition2D");
+  // Update the weights of each particle using a mult-variate Gaussian. Particles are processed in blocks,
+  // each observation is transformed for the whole block at once, and the Gaussian exponents are accumulated
+  // per particle, so that the weight only takes one exp per particle:
+  //   weight = prod(c1 / exp(e_i)) = exp(count * log(c1) - sum(e_i))
+  LatencyBudget::Clock::time_point start = LatencyBudget::Clock::now();
+  const std::vector<LandmarkObs>& observations = selectObservations(observed);
+  associations.reset(num_particles, observations.size());
+  resetAssociationRows();
+  const double* px = particles.x.data();
+  const double* py = particles.y.data();
+  double log_c1 = log(0.5/(M_PI*std_landmark[0]*std_landmark[1]));
+  // The probability is computed according to the distance deviation between the nearest landmark and the
+  // particle's "observation". However, when there is a bigger deviation, the probability may become
+  // very low, and results in 0 weights for all particles. When this happen, the filter will not
+  // be able to produce useful result. To avoid this problem, we flatten the distribution by an order
+  // of magnitude - by dividing the exponent by 10. This is fine since weights are relative.
+  double scale_x = 1. / (20 * square(std_landmark[0]));
+  double scale_y = 1. / (20 * square(std_landmark[1]));
+  double range2 = square(sensor_range);
+  parallelFor([&](int begin, int end, int part) {
+    double sin_theta[KERNEL_BLOCK];
+    double cos_theta[KERNEL_BLOCK];
+    double obs_x[KERNEL_BLOCK];
+    double obs_y[KERNEL_BLOCK];
+    double landmark_x[KERNEL_BLOCK];
+    double landmark_y[KERNEL_BLOCK];
+    double exponent[KERNEL_BLOCK];
+    double count[KERNEL_BLOCK];
+    double likelihood[KERNEL_BLOCK];
+    int nearest[KERNEL_BLOCK];
+    double distance[KERNEL_BLOCK];
+    int candidates[KERNEL_BLOCK];
+    long part_searches = 0;
+    long part_searched = 0;
+    for (int i = begin; i < end; i += KERNEL_BLOCK) {
+      int n = std::min(KERNEL_BLOCK, end - i);
+      ParticleKernels::sincos(&particles.theta[i], sin_theta, cos_theta, n);
+      std::fill(exponent, exponent + n, 0.);
+      std::fill(count, count + n, 0.);
+      for (auto it = observations.begin();
+           it != observations.end(); it++) {
+        const LandmarkObs& obs = *it;
+
+        // Transform observation coordinate to map coordinate
+        ParticleKernels::transform(px + i, py + i, sin_theta, cos_theta, n, obs.x, obs.y, obs_x, obs_y);
+        // Find the nearest landmarks of the whole block at once
+        index.findNearestBatch(obs_x, obs_y, n, nearest, distance, candidates);
+        for (int j = 0; j < n; j++) {
+#ifdef VERBOSE_OUT
+          std::cout << "Search:" << (i + j) << " (" << px[i + j] << "," << py[i + j] << ","
+                    << particles.theta[i + j] << ")" << "(" << obs.x << "," << obs.y << ")"<< std::endl;
+#endif
+          part_searches++;
+          int k = nearest[j];
+          if (k >= 0 && dist2(px[i + j], py[i + j], index.pointX(k), index.pointY(k)) < range2) {
+            // we have found one
+            part_searched += candidates[j];
+            Map::single_landmark_s* landmark = index.object(k);
+#ifdef VERBOSE_OUT
+            std::cout << "Found " << landmark->id() << "(" << landmark->x() << "," << landmark->y() << "), distance: " 
+                      << distance[j] << ", searched: " << candidates[j] << std::endl;
+#endif
+            landmark_x[j] = index.pointX(k);
+            landmark_y[j] = index.pointY(k);
+            count[j]++;
+            associations.add(i + j, landmark->id(), obs_x[j], obs_y[j]);
+          } else { // no contribution to the exponent
+            landmark_x[j] = obs_x[j];
+            landmark_y[j] = obs_y[j];
+          }
+        }
+        ParticleKernels::accumulate(obs_x, obs_y, landmark_x, landmark_y, n, scale_x, scale_y, exponent);
+      }
+      ParticleKernels::likelihood(exponent, count, n, log_c1, likelihood);
+      // The particles keep their weights from the previous update unless they have been resampled
+      double* weight = &particles.weight[i];
+      if (weights_uniform) {
+        std::copy(likelihood, likelihood + n, weight);
+      } else {
+        for (int j = 0; j < n; j++) {
+          weight[j] *= likelihood[j];
+        }
+      }
+    }
+    searches += part_searches;
+    searched += part_searched;
+  });
+  weights_uniform = false;
+  normalizeWeights();
+  budget.record(LatencyBudget::UPDATE, start, num_particles, observations.size());
+}
 
 #endif /* PARTICLE_FILTER_H_ */
@@ -0,0 +1,357 @@
+/*
+ * ParticleKernels.cpp
+ *
+ * Scalar, SSE2, and AVX2 implementations of the particle kernels, and their runtime selection.
+ */
+
+#include <math.h>
+#include "ParticleKernels.h"
+#include "../utils/helper_functions.h"
+#include "../utils/simd_math.h"
+
+namespace {
+
+typedef void (*PredictKernel)(double *, double *, double *, const double *, const double *, const double *, int,
+                              double, double, double);
+typedef void (*GaussianKernel)(const double *, const double *, int, double, double, double *, double *);
+typedef void (*SinCosKernel)(const double *, double *, double *, int);
+typedef void (*TransformKernel)(const double *, const double *, const double *, const double *, int, double,
+                                double, double *, double *);
+typedef void (*AccumulateKernel)(const double *, const double *, const double *, const double *, int, double,
+                                 double, double *);
+typedef void (*LikelihoodKernel)(const double *, const double *, int, double, double *);
+
+/**
+ * Motion of a particle over one time step. Expanding sin(theta + d) and cos(theta + d) leaves a single
+ * sin/cos of the particle's yaw per particle:
+ *   dx = a * sin(theta) + b * cos(theta)
+ *   dy = b * sin(theta) - a * cos(theta)
+ */
+struct Motion {
+  double a;
+  double b;
+  double dtheta;
+
+  Motion(double delta_t, double velocity, double yaw_rate) {
+    dtheta = yaw_rate * delta_t;
+    // We need to handle the situation when yaw rate is 0
+    if (fabs(yaw_rate) > EPSILON) {
+      double k = velocity / yaw_rate;
+      // cos(d) - 1 = -2 * sin(d/2)^2, which does not cancel for small d
+      a = -2 * k * square(sin(dtheta / 2));
+      b = k * sin(dtheta);
+    } else {
+      a = 0;
+      b = velocity * delta_t;
+    }
+  }
+};
+
+void predictScalar(double *x, double *y, double *theta, const double *noise_x, const double *noise_y,
+                   const double *noise_theta, int n, double delta_t, double velocity, double yaw_rate) {
+  Motion m(delta_t, velocity, yaw_rate);
+  for (int i = 0; i < n; i++) {
+    double s = sin(theta[i]);
+    double c = cos(theta[i]);
+    x[i] += m.a * s + m.b * c + noise_x[i];
+    y[i] += m.b * s - m.a * c + noise_y[i];
+    theta[i] += m.dtheta + noise_theta[i];
+  }
+}
+
+void gaussianScalar(const double *u, const double *v, int n, double scale_c, double scale_s, double *out_c,
+                    double *out_s) {
+  for (int i = 0; i < n; i++) {
+    double r = sqrt(-2 * log(u[i]));
+    double a = 2 * M_PI * v[i];
+    out_c[i] = scale_c * r * cos(a);
+    out_s[i] = scale_s * r * sin(a);
+  }
+}
+
+void sincosScalar(const double *theta, double *s, double *c, int n) {
+  for (int i = 0; i < n; i++) {
+    s[i] = sin(theta[i]);
+    c[i] = cos(theta[i]);
+  }
+}
+
+void transformScalar(const double *x, const double *y, const double *s, const double *c, int n, double obs_x,
+                     double obs_y, double *out_x, double *out_y) {
+  for (int i = 0; i < n; i++) {
+    out_x[i] = x[i] + obs_x * c[i] - obs_y * s[i];
+    out_y[i] = y[i] + obs_x * s[i] + obs_y * c[i];
+  }
+}
+
+void accumulateScalar(const double *obs_x, const double *obs_y, const double *landmark_x, const double *landmark_y,
+                      int n, double scale_x, double scale_y, double *exponent) {
+  for (int i = 0; i < n; i++) {
+    exponent[i] += square(obs_x[i] - landmark_x[i]) * scale_x + square(obs_y[i] - landmark_y[i]) * scale_y;
+  }
+}
+
+void likelihoodScalar(const double *exponent, const double *count, int n, double log_c, double *weight) {
+  for (int i = 0; i < n; i++) {
+    weight[i] = exp(count[i] * log_c - exponent[i]);
+  }
+}
+
+#ifdef PF_SIMD_X86
+PF_TARGET_SSE2 void predictSSE2(double *x, double *y, double *theta, const double *noise_x, const double *noise_y,
+                                const double *noise_theta, int n, double delta_t, double velocity, double yaw_rate) {
+  Motion m(delta_t, velocity, yaw_rate);
+  __m128d a = _mm_set1_pd(m.a);
+  __m128d b = _mm_set1_pd(m.b);
+  __m128d dtheta = _mm_set1_pd(m.dtheta);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d t = _mm_loadu_pd(theta + i);
+    __m128d s, c;
+    sincos_pd(t, s, c);
+    __m128d dx = _mm_add_pd(_mm_mul_pd(a, s), _mm_mul_pd(b, c));
+    __m128d dy = _mm_sub_pd(_mm_mul_pd(b, s), _mm_mul_pd(a, c));
+    _mm_storeu_pd(x + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_add_pd(dx, _mm_loadu_pd(noise_x + i))));
+    _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_add_pd(dy, _mm_loadu_pd(noise_y + i))));
+    _mm_storeu_pd(theta + i, _mm_add_pd(t, _mm_add_pd(dtheta, _mm_loadu_pd(noise_theta + i))));
+  }
+  predictScalar(x + i, y + i, theta + i, noise_x + i, noise_y + i, noise_theta + i, n - i, delta_t, velocity,
+                yaw_rate);
+}
+
+PF_TARGET_SSE2 void gaussianSSE2(const double *u, const double *v, int n, double scale_c, double scale_s,
+                                 double *out_c, double *out_s) {
+  __m128d sc = _mm_set1_pd(scale_c);
+  __m128d ss = _mm_set1_pd(scale_s);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d r = _mm_sqrt_pd(_mm_mul_pd(_mm_set1_pd(-2), log_pd(_mm_loadu_pd(u + i))));
+    __m128d s, c;
+    sincos_pd(_mm_mul_pd(_mm_set1_pd(2 * M_PI), _mm_loadu_pd(v + i)), s, c);
+    _mm_storeu_pd(out_c + i, _mm_mul_pd(_mm_mul_pd(sc, r), c));
+    _mm_storeu_pd(out_s + i, _mm_mul_pd(_mm_mul_pd(ss, r), s));
+  }
+  gaussianScalar(u + i, v + i, n - i, scale_c, scale_s, out_c + i, out_s + i);
+}
+
+PF_TARGET_SSE2 void sincosSSE2(const double *theta, double *s, double *c, int n) {
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d vs, vc;
+    sincos_pd(_mm_loadu_pd(theta + i), vs, vc);
+    _mm_storeu_pd(s + i, vs);
+    _mm_storeu_pd(c + i, vc);
+  }
+  sincosScalar(theta + i, s + i, c + i, n - i);
+}
+
+PF_TARGET_SSE2 void transformSSE2(const double *x, const double *y, const double *s, const double *c, int n,
+                                  double obs_x, double obs_y, double *out_x, double *out_y) {
+  __m128d ox = _mm_set1_pd(obs_x);
+  __m128d oy = _mm_set1_pd(obs_y);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d vs = _mm_loadu_pd(s + i);
+    __m128d vc = _mm_loadu_pd(c + i);
+    _mm_storeu_pd(out_x + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_sub_pd(_mm_mul_pd(ox, vc), _mm_mul_pd(oy, vs))));
+    _mm_storeu_pd(out_y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_add_pd(_mm_mul_pd(ox, vs), _mm_mul_pd(oy, vc))));
+  }
+  transformScalar(x + i, y + i, s + i, c + i, n - i, obs_x, obs_y, out_x + i, out_y + i);
+}
+
+PF_TARGET_SSE2 void accumulateSSE2(const double *obs_x, const double *obs_y, const double *landmark_x,
+                                   const double *landmark_y, int n, double scale_x, double scale_y,
+                                   double *exponent) {
+  __m128d sx = _mm_set1_pd(scale_x);
+  __m128d sy = _mm_set1_pd(scale_y);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d dx = _mm_sub_pd(_mm_loadu_pd(obs_x + i), _mm_loadu_pd(landmark_x + i));
+    __m128d dy = _mm_sub_pd(_mm_loadu_pd(obs_y + i), _mm_loadu_pd(landmark_y + i));
+    __m128d e = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(dx, dx), sx), _mm_mul_pd(_mm_mul_pd(dy, dy), sy));
+    _mm_storeu_pd(exponent + i, _mm_add_pd(_mm_loadu_pd(exponent + i), e));
+  }
+  accumulateScalar(obs_x + i, obs_y + i, landmark_x + i, landmark_y + i, n - i, scale_x, scale_y, exponent + i);
+}
+
+PF_TARGET_SSE2 void likelihoodSSE2(const double *exponent, const double *count, int n, double log_c,
+                                   double *weight) {
+  __m128d lc = _mm_set1_pd(log_c);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d e = _mm_sub_pd(_mm_mul_pd(_mm_loadu_pd(count + i), lc), _mm_loadu_pd(exponent + i));
+    _mm_storeu_pd(weight + i, exp_pd(e));
+  }
+  likelihoodScalar(exponent + i, count + i, n - i, log_c, weight + i);
+}
+
+PF_TARGET_AVX2 void predictAVX2(double *x, double *y, double *theta, const double *noise_x, const double *noise_y,
+                                const double *noise_theta, int n, double delta_t, double velocity, double yaw_rate) {
+  Motion m(delta_t, velocity, yaw_rate);
+  __m256d a = _mm256_set1_pd(m.a);
+  __m256d b = _mm256_set1_pd(m.b);
+  __m256d dtheta = _mm256_set1_pd(m.dtheta);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d t = _mm256_loadu_pd(theta + i);
+    __m256d s, c;
+    sincos_pd(t, s, c);
+    __m256d dx = _mm256_fmadd_pd(a, s, _mm256_mul_pd(b, c));
+    __m256d dy = _mm256_fmsub_pd(b, s, _mm256_mul_pd(a, c));
+    _mm256_storeu_pd(x + i, _mm256_add_pd(_mm256_loadu_pd(x + i), _mm256_add_pd(dx, _mm256_loadu_pd(noise_x + i))));
+    _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_add_pd(dy, _mm256_loadu_pd(noise_y + i))));
+    _mm256_storeu_pd(theta + i, _mm256_add_pd(t, _mm256_add_pd(dtheta, _mm256_loadu_pd(noise_theta + i))));
+  }
+  predictScalar(x + i, y + i, theta + i, noise_x + i, noise_y + i, noise_theta + i, n - i, delta_t, velocity,
+                yaw_rate);
+}
+PF_TARGET_AVX2 void gaussianAVX2(const double *u, const double *v, int n, double scale_c, double scale_s,
+                                 double *out_c, double *out_s) {
+  __m256d sc = _mm256_set1_pd(scale_c);
+  __m256d ss = _mm256_set1_pd(scale_s);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d r = _mm256_sqrt_pd(_mm256_mul_pd(_mm256_set1_pd(-2), log_pd(_mm256_loadu_pd(u + i))));
+    __m256d s, c;
+    sincos_pd(_mm256_mul_pd(_mm256_set1_pd(2 * M_PI), _mm256_loadu_pd(v + i)), s, c);
+    _mm256_storeu_pd(out_c + i, _mm256_mul_pd(_mm256_mul_pd(sc, r), c));
+    _mm256_storeu_pd(out_s + i, _mm256_mul_pd(_mm256_mul_pd(ss, r), s));
+  }
+  gaussianScalar(u + i, v + i, n - i, scale_c, scale_s, out_c + i, out_s + i);
+}
+
+PF_TARGET_AVX2 void sincosAVX2(const double *theta, double *s, double *c, int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d vs, vc;
+    sincos_pd(_mm256_loadu_pd(theta + i), vs, vc);
+    _mm256_storeu_pd(s + i, vs);
+    _mm256_storeu_pd(c + i, vc);
+  }
+  sincosScalar(theta + i, s + i, c + i, n - i);
+}
+
+PF_TARGET_AVX2 void transformAVX2(const double *x, const double *y, const double *s, const double *c, int n,
+                                  double obs_x, double obs_y, double *out_x, double *out_y) {
+  __m256d ox = _mm256_set1_pd(obs_x);
+  __m256d oy = _mm256_set1_pd(obs_y);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d vs = _mm256_loadu_pd(s + i);
+    __m256d vc = _mm256_loadu_pd(c + i);
+    _mm256_storeu_pd(out_x + i, _mm256_add_pd(_mm256_loadu_pd(x + i), _mm256_fmsub_pd(ox, vc, _mm256_mul_pd(oy, vs))));
+    _mm256_storeu_pd(out_y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_fmadd_pd(ox, vs, _mm256_mul_pd(oy, vc))));
+  }
+  transformScalar(x + i, y + i, s + i, c + i, n - i, obs_x, obs_y, out_x + i, out_y + i);
+}
+
+PF_TARGET_AVX2 void accumulateAVX2(const double *obs_x, const double *obs_y, const double *landmark_x,
+                                   const double *landmark_y, int n, double scale_x, double scale_y,
+                                   double *exponent) {
+  __m256d sx = _mm256_set1_pd(scale_x);
+  __m256d sy = _mm256_set1_pd(scale_y);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(obs_x + i), _mm256_loadu_pd(landmark_x + i));
+    __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(obs_y + i), _mm256_loadu_pd(landmark_y + i));
+    __m256d e = _mm256_fmadd_pd(_mm256_mul_pd(dx, dx), sx, _mm256_loadu_pd(exponent + i));
+    _mm256_storeu_pd(exponent + i, _mm256_fmadd_pd(_mm256_mul_pd(dy, dy), sy, e));
+  }
+  accumulateScalar(obs_x + i, obs_y + i, landmark_x + i, landmark_y + i, n - i, scale_x, scale_y, exponent + i);
+}
+
+PF_TARGET_AVX2 void likelihoodAVX2(const double *exponent, const double *count, int n, double log_c,
+                                   double *weight) {
+  __m256d lc = _mm256_set1_pd(log_c);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d e = _mm256_fmsub_pd(_mm256_loadu_pd(count + i), lc, _mm256_loadu_pd(exponent + i));
+    _mm256_storeu_pd(weight + i, exp_pd(e));
+  }
+  likelihoodScalar(exponent + i, count + i, n - i, log_c, weight + i);
+}
+#endif
+
+/**
+ * The kernels selected for the CPU we are running on
+ */
+struct Dispatch {
+  const char *name;
+  PredictKernel predict;
+  GaussianKernel gaussian;
+  SinCosKernel sincos;
+  TransformKernel transform;
+  AccumulateKernel accumulate;
+  LikelihoodKernel likelihood;
+
+  Dispatch() {
+    name = "scalar";
+    predict = predictScalar;
+    gaussian = gaussianScalar;
+    sincos = sincosScalar;
+    transform = transformScalar;
+    accumulate = accumulateScalar;
+    likelihood = likelihoodScalar;
+#ifdef PF_SIMD_X86
+    if (cpuSupportsAVX2()) {
+      name = "avx2";
+      predict = predictAVX2;
+      gaussian = gaussianAVX2;
+      sincos = sincosAVX2;
+      transform = transformAVX2;
+      accumulate = accumulateAVX2;
+      likelihood = likelihoodAVX2;
+    } else if (cpuSupportsSSE2()) {
+      name = "sse2";
+      predict = predictSSE2;
+      gaussian = gaussianSSE2;
+      sincos = sincosSSE2;
+      transform = transformSSE2;
+      accumulate = accumulateSSE2;
+      likelihood = likelihoodSSE2;
+    }
+#endif
+  }
+};
+
+const Dispatch &kernels() {
+  static Dispatch dispatch;
+  return dispatch;
+}
+
+}
+
+void ParticleKernels::predict(double *x, double *y, double *theta, const double *noise_x, const double *noise_y,
+                              const double *noise_theta, int n, double delta_t, double velocity,
+                              double yaw_rate) {
+  kernels().predict(x, y, theta, noise_x, noise_y, noise_theta, n, delta_t, velocity, yaw_rate);
+}
+
+void ParticleKernels::gaussian(const double *u, const double *v, int n, double scale_c, double scale_s,
+                               double *out_c, double *out_s) {
+  kernels().gaussian(u, v, n, scale_c, scale_s, out_c, out_s);
+}
+
+void ParticleKernels::sincos(const double *theta, double *s, double *c, int n) {
+  kernels().sincos(theta, s, c, n);
+}
+
+void ParticleKernels::transform(const double *x, const double *y, const double *s, const double *c, int n,
+                                double obs_x, double obs_y, double *out_x, double *out_y) {
+  kernels().transform(x, y, s, c, n, obs_x, obs_y, out_x, out_y);
+}
+
+void ParticleKernels::accumulate(const double *obs_x, const double *obs_y, const double *landmark_x,
+                                 const double *landmark_y, int n, double scale_x, double scale_y,
+                                 double *exponent) {
+  kernels().accumulate(obs_x, obs_y, landmark_x, landmark_y, n, scale_x, scale_y, exponent);
+}
+
+void ParticleKernels::likelihood(const double *exponent, const double *count, int n, double log_c,
+                                 double *weight) {
+  kernels().likelihood(exponent, count, n, log_c, weight);
+}
+
+const char *ParticleKernels::instructionSet() {
+  return kernels().name;
+}
@@ -0,0 +1,98 @@
+#ifndef _FILTER_PARTICLEKERNELS_H_
+#define _FILTER_PARTICLEKERNELS_H_
+
+/**
+ * Data-parallel kernels operating on blocks of particles stored as structure of arrays. Each kernel has a
+ * scalar, an SSE2, and an AVX2 implementation, the best one supported by the CPU is selected at runtime
+ * on first use.
+ */
+class ParticleKernels {
+  public:
+    /**
+     * Advance a block of particles with the motion model and add the given noise
+     * @param x the x coordinates, updated in place
+     * @param y the y coordinates, updated in place
+     * @param theta the yaws, updated in place
+     * @param noise_x the x noise of each particle
+     * @param noise_y the y noise of each particle
+     * @param noise_theta the yaw noise of each particle
+     * @param n the number of particles
+     * @param delta_t Time between time step t and t+1 in measurements [s]
+     * @param velocity Velocity of car from t to t+1 [m/s]
+     * @param yaw_rate Yaw rate of car from t to t+1 [rad/s]
+     */
+    static void predict(double *x, double *y, double *theta, const double *noise_x, const double *noise_y,
+                        const double *noise_theta, int n, double delta_t, double velocity, double yaw_rate);
+
+    /**
+     * Transform pairs of uniform random numbers to pairs of independent normal random numbers with the
+     * Box-Muller transform, out_c = scale_c * sqrt(-2 log(u)) * cos(2 PI v), and
+     * out_s = scale_s * sqrt(-2 log(u)) * sin(2 PI v)
+     * @param u the first uniform numbers of the pairs, in (0, 1]
+     * @param v the second uniform numbers of the pairs
+     * @param n the number of pairs
+     * @param scale_c the standard deviation of out_c
+     * @param scale_s the standard deviation of out_s
+     * @param out_c receives the first normal numbers
+     * @param out_s receives the second normal numbers
+     */
+    static void gaussian(const double *u, const double *v, int n, double scale_c, double scale_s, double *out_c,
+                         double *out_s);
+
+    /**
+     * Compute sin and cos of the yaws of a block of particles
+     * @param theta the yaws
+     * @param s receives the sines
+     * @param c receives the cosines
+     * @param n the number of particles
+     */
+    static void sincos(const double *theta, double *s, double *c, int n);
+
+    /**
+     * Transform an observation from the vehicle's coordinate system to the map's coordinate system for a
+     * block of particles
+     * @param x the particles' x coordinates
+     * @param y the particles' y coordinates
+     * @param s the sines of the particles' yaws
+     * @param c the cosines of the particles' yaws
+     * @param n the number of particles
+     * @param obs_x the observation's x coordinate
+     * @param obs_y the observation's y coordinate
+     * @param out_x receives the map x coordinate of the observation for each particle
+     * @param out_y receives the map y coordinate of the observation for each particle
+     */
+    static void transform(const double *x, const double *y, const double *s, const double *c, int n,
+                          double obs_x, double obs_y, double *out_x, double *out_y);
+
+    /**
+     * Accumulate the Gaussian exponents of the deviations between observations and their landmarks,
+     * exponent += (obs_x - landmark_x)^2 * scale_x + (obs_y - landmark_y)^2 * scale_y
+     * @param obs_x the observations' map x coordinates
+     * @param obs_y the observations' map y coordinates
+     * @param landmark_x the associated landmarks' x coordinates, the observation's own when there is none
+     * @param landmark_y the associated landmarks' y coordinates, the observation's own when there is none
+     * @param n the number of particles
+     * @param scale_x the scale of the squared x deviation
+     * @param scale_y the scale of the squared y deviation
+     * @param exponent the accumulated exponents
+     */
+    static void accumulate(const double *obs_x, const double *obs_y, const double *landmark_x,
+                           const double *landmark_y, int n, double scale_x, double scale_y, double *exponent);
+
+    /**
+     * Compute the weights from the accumulated exponents, weight = exp(count * log_c - exponent)
+     * @param exponent the accumulated exponents
+     * @param count the number of associated observations
+     * @param n the number of particles
+     * @param log_c the log of the Gaussian's normalization factor
+     * @param weight receives the weights
+     */
+    static void likelihood(const double *exponent, const double *count, int n, double log_c, double *weight);
+
+    /**
+     * @return the name of the instruction set used by the kernels: "avx2", "sse2", or "scalar"
+     */
+    static const char *instructionSet();
+};
+
+#endif
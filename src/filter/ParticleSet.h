@@ -0,0 +1,98 @@
+#ifndef _FILTER_PARTICLESET_H_
+#define _FILTER_PARTICLESET_H_
+#include <vector>
+
+/**
+ * Structure-of-arrays storage of particle poses and weights. Each attribute lives in its own contiguous
+ * array, so the prediction and update passes only stream over the data they actually use.
+ */
+class ParticleSet {
+  public:
+    // The x coordinates
+    std::vector<double> x;
+    // The y coordinates
+    std::vector<double> y;
+    // The yaws
+    std::vector<double> theta;
+    // The weights
+    std::vector<double> weight;
+
+    /**
+     * @return the number of particles
+     */
+    int size() const {
+      return x.size();
+    }
+
+    /**
+     * Resize the set, new particles are at the origin with weight 1
+     * @param n the number of particles
+     */
+    void resize(int n) {
+      x.resize(n, 0);
+      y.resize(n, 0);
+      theta.resize(n, 0);
+      weight.resize(n, 1);
+    }
+
+    /**
+     * Remove all particles
+     */
+    void clear() {
+      x.clear();
+      y.clear();
+      theta.clear();
+      weight.clear();
+    }
+
+    /**
+     * Reserve capacity for the given number of particles
+     * @param n the number of particles
+     */
+    void reserve(int n) {
+      x.reserve(n);
+      y.reserve(n);
+      theta.reserve(n);
+      weight.reserve(n);
+    }
+
+    /**
+     * Append a particle
+     * @param px the x coordinate
+     * @param py the y coordinate
+     * @param ptheta the yaw
+     * @param pweight the weight
+     */
+    void add(double px, double py, double ptheta, double pweight = 1) {
+      x.push_back(px);
+      y.push_back(py);
+      theta.push_back(ptheta);
+      weight.push_back(pweight);
+    }
+
+    /**
+     * Copy a particle from another set
+     * @param to the index of the particle to overwrite
+     * @param from the set to copy from
+     * @param index the index of the particle in from
+     */
+    void copy(int to, const ParticleSet &from, int index) {
+      x[to] = from.x[index];
+      y[to] = from.y[index];
+      theta[to] = from.theta[index];
+      weight[to] = from.weight[index];
+    }
+
+    /**
+     * Swap content with another set
+     * @param other the other set
+     */
+    void swap(ParticleSet &other) {
+      x.swap(other.x);
+      y.swap(other.y);
+      theta.swap(other.theta);
+      weight.swap(other.weight);
+    }
+};
+
+#endif
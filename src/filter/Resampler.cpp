@@ -0,0 +1,105 @@
+/*
+ * Resampler.cpp
+ *
+ * Linear time resampling strategies.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include "Resampler.h"
+
+void Resampler::merge(const double *cumulative, int n, const double *points, int count, int *ancestors) {
+  int k = 0;
+  for (int i = 0; i < count; i++) {
+    while (k < n - 1 && cumulative[k] <= points[i]) {
+      k++;
+    }
+    ancestors[i] = k;
+  }
+}
+
+void Resampler::multinomial(const double *weights, int n, int count, Philox::Stream &random, int *ancestors) {
+  cumulative.resize(n + count);
+  double total = 0;
+  for (int i = 0; i < n; i++) {
+    total += weights[i];
+    cumulative[i] = total;
+  }
+  // The partial sums of count + 1 exponential variables, divided by their total, are count sorted uniforms
+  double *points = &cumulative[n];
+  double sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum -= log(Philox::uniform(random()));
+    points[i] = sum;
+  }
+  sum -= log(Philox::uniform(random()));
+  double scale = total / sum;
+  for (int i = 0; i < count; i++) {
+    points[i] *= scale;
+  }
+  merge(cumulative.data(), n, points, count, ancestors);
+}
+
+void Resampler::resample(const double *weights, int n, int count, Philox::Stream &random, int *ancestors) {
+  double total = 0;
+  for (int i = 0; i < n; i++) {
+    total += weights[i];
+  }
+  if (!(total > 0)) { // nothing to go by, draw uniformly
+    for (int i = 0; i < count; i++) {
+      ancestors[i] = (long(i) * n) / count;
+    }
+    return;
+  }
+
+  if (strategy == MULTINOMIAL) {
+    multinomial(weights, n, count, random, ancestors);
+  } else if (strategy == RESIDUAL) {
+    // Copy each particle floor(count * normalized weight) times, and draw the rest from the residual weights
+    residuals.resize(n);
+    int copied = 0;
+    for (int i = 0; i < n; i++) {
+      double expected = weights[i] * count / total;
+      int copies = std::min(int(expected), count - copied);
+      for (int j = 0; j < copies; j++) {
+        ancestors[copied++] = i;
+      }
+      residuals[i] = expected - copies;
+    }
+    if (copied < count) {
+      multinomial(residuals.data(), n, count - copied, random, ancestors + copied);
+    }
+  } else { // SYSTEMATIC or STRATIFIED
+    cumulative.resize(n + count);
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+      sum += weights[i];
+      cumulative[i] = sum;
+    }
+    double *points = &cumulative[n];
+    double step = total / count;
+    double offset = Philox::uniform(random());
+    for (int i = 0; i < count; i++) {
+      if (strategy == STRATIFIED) {
+        offset = Philox::uniform(random());
+      }
+      points[i] = (i + offset) * step;
+    }
+    merge(cumulative.data(), n, points, count, ancestors);
+  }
+}
+
+bool Resampler::parse(const std::string &name, Strategy &strategy) {
+  if (name == "multinomial") {
+    strategy = MULTINOMIAL;
+  } else if (name == "systematic") {
+    strategy = SYSTEMATIC;
+  } else if (name == "stratified") {
+    strategy = STRATIFIED;
+  } else if (name == "residual") {
+    strategy = RESIDUAL;
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,95 @@
+#ifndef _FILTER_RESAMPLER_H_
+#define _FILTER_RESAMPLER_H_
+#include <string>
+#include <vector>
+#include "../utils/Philox.h"
+
+/**
+ * Draws the ancestors of a new generation of particles in proportion to the particles' weights. All
+ * strategies make a single pass over the cumulative weights, merging it with a sorted sequence of uniform
+ * points, so resampling takes linear time.
+ */
+class Resampler {
+  public:
+    enum Strategy {
+      // Independent draws, the points are sorted uniforms generated from exponential spacings
+      MULTINOMIAL,
+      // One random offset, then evenly spaced points
+      SYSTEMATIC,
+      // One random point in each of the evenly sized strata
+      STRATIFIED,
+      // floor(count * normalized weight) deterministic copies, the rest is drawn multinomially
+      RESIDUAL
+    };
+
+  private:
+    Strategy strategy;
+
+    // Cumulative weights
+    std::vector<double> cumulative;
+
+    // Residual weights of the residual strategy
+    std::vector<double> residuals;
+
+    /**
+     * Merge sorted points with the cumulative weights
+     * @param cumulative the cumulative weights
+     * @param n the number of weights
+     * @param points the sorted points, in [0, cumulative[n - 1])
+     * @param count the number of points
+     * @param ancestors receives the ancestor of each point
+     */
+    static void merge(const double *cumulative, int n, const double *points, int count, int *ancestors);
+
+    /**
+     * Draw multinomially
+     * @param weights the weights
+     * @param n the number of weights
+     * @param count the number of ancestors to draw
+     * @param random the random numbers
+     * @param ancestors receives the ancestors
+     */
+    void multinomial(const double *weights, int n, int count, Philox::Stream &random, int *ancestors);
+
+  public:
+    /**
+     * Create a resampler
+     * @param strategy the strategy to use
+     */
+    Resampler(Strategy strategy = MULTINOMIAL) : strategy(strategy) {}
+
+    /**
+     * @return the strategy
+     */
+    Strategy getStrategy() const {
+      return strategy;
+    }
+
+    /**
+     * Set the strategy
+     * @param strategy the strategy to use
+     */
+    void setStrategy(Strategy strategy) {
+      this->strategy = strategy;
+    }
+
+    /**
+     * Draw ancestors in proportion to the weights, all ancestors are drawn uniformly if the weights sum to 0
+     * @param weights the weights
+     * @param n the number of weights
+     * @param count the number of ancestors to draw
+     * @param random the random numbers
+     * @param ancestors receives count ancestors, the indexes of the drawn weights
+     */
+    void resample(const double *weights, int n, int count, Philox::Stream &random, int *ancestors);
+
+    /**
+     * Get a strategy by its name
+     * @param name "multinomial", "systematic", "stratified", or "residual"
+     * @param strategy receives the strategy
+     * @return false if the name is unknown
+     */
+    static bool parse(const std::string &name, Strategy &strategy);
+};
+
+#endif
@@ -1,9 +1,17 @@
 #include <math.h>
 #include <uWS/uWS.h>
+#include <algorithm>
 #include <iostream>
 #include <tuple>
 #include "json.hpp"
 #include "filter/ParticleFilter.h"
+#include "map/KDTree2D.h"
+#include "map/QuadTree2D.h"
+#include "map/SparseGrid2D.h"
+#include "map/TiledMap.h"
+#include "map/MapFile.h"
+#include "map/NearestRaster.h"
+#include "filter/ParticleKernels.h"
 
 using namespace std;
 
@@ -28,6 +36,13 @@ std::string hasData(std::string s) {
 int main(int argc, char* argv[]) {
   uWS::Hub h;
   Partition2D<Map::single_landmark_s> partition;
+  KDTree2D<Map::single_landmark_s> kdtree;
+  QuadTree2D<Map::single_landmark_s> quadtree;
+  SparseGrid2D<Map::single_landmark_s> sparse;
+  TiledMap tiles;
+  MapFile mapFile;
+  NearestRaster<Map::single_landmark_s> raster;
+  LikelihoodField<Map::single_landmark_s> field;
 
   // Set up parameters here
   double delta_t = 0.1;      // Time elapsed between measurements [sec]
@@ -41,6 +56,24 @@ int main(int argc, char* argv[]) {
       0.3, 0.3};  // Landmark measurement uncertainty [x [m], y [m]]
 
   int nParticles = 1000;
+  int nThreads = 1;
+  unsigned long seed = 0;
+  Resampler::Strategy resampling = Resampler::MULTINOMIAL;
+  double resamplingThreshold = 1;
+  KLDSampler kld;
+  int kldMaxParticles = 0;
+  double kldBins[3] = {0.5, 0.5, 0.1};
+  double deadline = 0;
+  std::string landmarkIndex = "grid";
+  float rasterResolution = 0.1;
+  std::string measurementModel = "nearest";
+  float fieldResolution = 0.1;
+  bool useLocalPartition = false;
+  float cellSize = 5;        // Partition cell size [m], 0 chooses it from the map
+  std::string tileDirectory; // Tiled map directory, empty to load the whole map
+  int tileCache = 64;        // Number of tiles to cache
+  std::string mapFileName;   // Binary map file, empty to read the text map
+  const int minBudgetParticles = 100;
   
   // Process command line options
   for (int i = 1; i < argc; i++) {
@@ -53,6 +86,103 @@ int main(int argc, char* argv[]) {
         std::cerr << "Invalid number of particles: " << argv[i] << std::endl;
         exit(-1);
       }
+    } else if (std::string((argv[i])) == "-threads") { // Set the number of threads to process particles
+      if (sscanf(argv[++i], "%d", &nThreads) != 1) {
+        std::cerr << "Invalid number of threads: " << argv[i] << std::endl;
+        exit(-1);
+      }
+      if (nThreads <= 0) {
+        std::cerr << "Invalid number of threads: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-seed") { // Set the seed of the random numbers
+      if (sscanf(argv[++i], "%lu", &seed) != 1) {
+        std::cerr << "Invalid seed: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-resample") { // Set the resampling strategy
+      if (!Resampler::parse(argv[++i], resampling)) {
+        std::cerr << "Invalid resampling strategy: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-ess") { // Set the effective sample size ratio to resample at
+      if (sscanf(argv[++i], "%lf", &resamplingThreshold) != 1) {
+        std::cerr << "Invalid effective sample size ratio: " << argv[i] << std::endl;
+        exit(-1);
+      }
+      if (resamplingThreshold <= 0 || resamplingThreshold > 1) {
+        std::cerr << "Invalid effective sample size ratio: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-kld") { // Enable KLD-sampling
+      double epsilon;
+      int minParticles, maxParticles;
+      if (sscanf(argv[++i], "%lf", &epsilon) != 1 || epsilon <= 0) {
+        std::cerr << "Invalid KLD-sampling epsilon: " << argv[i] << std::endl;
+        exit(-1);
+      }
+      if (sscanf(argv[++i], "%d", &minParticles) != 1 || minParticles <= 0) {
+        std::cerr << "Invalid KLD-sampling minimum number of particles: " << argv[i] << std::endl;
+        exit(-1);
+      }
+      if (sscanf(argv[++i], "%d", &maxParticles) != 1 || maxParticles < minParticles) {
+        std::cerr << "Invalid KLD-sampling maximum number of particles: " << argv[i] << std::endl;
+        exit(-1);
+      }
+      kld = KLDSampler(epsilon, minParticles, maxParticles);
+      kldMaxParticles = maxParticles;
+    } else if (std::string((argv[i])) == "-kldbin") { // Set the KLD-sampling bin size
+      for (int k = 0; k < 3; k++) {
+        if (sscanf(argv[++i], "%lf", &kldBins[k]) != 1 || kldBins[k] <= 0) {
+          std::cerr << "Invalid KLD-sampling bin size: " << argv[i] << std::endl;
+          exit(-1);
+        }
+      }
+    } else if (std::string((argv[i])) == "-deadline") { // Set the latency budget of a frame
+      if (sscanf(argv[++i], "%lf", &deadline) != 1 || deadline <= 0) {
+        std::cerr << "Invalid deadline: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-index") { // Set the landmark index
+      landmarkIndex = argv[++i];
+      if (landmarkIndex == "raster") {
+        if (sscanf(argv[++i], "%f", &rasterResolution) != 1 || rasterResolution <= 0) {
+          std::cerr << "Invalid raster resolution: " << argv[i] << std::endl;
+          exit(-1);
+        }
+      } else if (landmarkIndex != "grid" && landmarkIndex != "kdtree" && landmarkIndex != "quadtree" &&
+                 landmarkIndex != "sparse") {
+        std::cerr << "Invalid landmark index: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-model") { // Set the measurement model
+      measurementModel = argv[++i];
+      if (measurementModel == "field") {
+        if (sscanf(argv[++i], "%f", &fieldResolution) != 1 || fieldResolution <= 0) {
+          std::cerr << "Invalid likelihood field resolution: " << argv[i] << std::endl;
+          exit(-1);
+        }
+      } else if (measurementModel != "nearest") {
+        std::cerr << "Invalid measurement model: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-local") { // Search the landmarks around the particles only
+      useLocalPartition = true;
+    } else if (std::string((argv[i])) == "-cellsize") { // Set the partition cell size
+      if (std::string(argv[++i]) == "auto") {
+        cellSize = 0;
+      } else if (sscanf(argv[i], "%f", &cellSize) != 1 || cellSize <= 0) {
+        std::cerr << "Invalid cell size: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-tiles") { // Stream the map from tiles
+      tileDirectory = argv[++i];
+      if (sscanf(argv[++i], "%d", &tileCache) != 1 || tileCache <= 0) {
+        std::cerr << "Invalid number of tiles to cache: " << argv[i] << std::endl;
+        exit(-1);
+      }
+    } else if (std::string((argv[i])) == "-mapfile") { // Use a binary map file
+      mapFileName = argv[++i];
     } else if (std::string((argv[i])) == "-stdgps") { // set std GPS deviation
       if (sscanf(argv[++i], "%lf", &sigma_pos[0]) != 1) {
         std::cerr << "Invalid GPS standard deviation x: " << argv[i] << std::endl;
@@ -87,9 +217,36 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  // Read map data
+  if (!tileDirectory.empty() && !mapFileName.empty()) {
+    std::cerr << "A tiled map and a binary map file can not be used together" << std::endl;
+    exit(-1);
+  }
+  if (!tileDirectory.empty() && (landmarkIndex != "grid" || measurementModel != "nearest")) {
+    std::cerr << "A tiled map only works with the grid index and the nearest landmark model" << std::endl;
+    exit(-1);
+  }
+  if (useLocalPartition && (landmarkIndex != "grid" || measurementModel != "nearest" || !tileDirectory.empty())) {
+    std::cerr << "A local partition only works with the grid index, the nearest landmark model, and a whole map"
+              << std::endl;
+    exit(-1);
+  }
+
+  // Read map data, a tiled map is read tile by tile as the particles move
   Map map;
-  if (!read_map_data("../data/map_data.txt", map)) {
+  if (!tileDirectory.empty()) {
+    if (!tiles.open(tileDirectory, tileCache, cellSize > 0? cellSize: 5, sensor_range)) {
+      cout << "Error: Could not open tiled map " << tileDirectory << endl;
+      return -1;
+    }
+    cout << "Tiles: " << tiles.tileSize() << " m, " << tileCache << " cached" << endl;
+  } else if (!mapFileName.empty()) {
+    // The partition searches the mapped file in place, the other indexes use a copy of its landmarks
+    if (!mapFile.open(mapFileName, partition)) {
+      cout << "Error: Could not open binary map file " << mapFileName << endl;
+      return -1;
+    }
+    map.landmark_list.assign(mapFile.landmarks(), mapFile.landmarks() + mapFile.size());
+  } else if (!read_map_data("../data/map_data.txt", map)) {
     cout << "Error: Could not open map file" << endl;
     return -1;
   }
@@ -103,13 +260,43 @@ int main(int argc, char* argv[]) {
     y1 = max(y1, it->y());
   }
 
-  cout << "World: " << x0 << ", " << y0 << ", " << x1 << ", " << y1 << endl;
+  if (tileDirectory.empty()) {
+    cout << "World: " << x0 << ", " << y0 << ", " << x1 << ", " << y1 << endl;
+  }
   cout << "Landmarks: " << map.landmark_list.size() << endl;
-
-  // Initialize the space partition
-  partition.initialize(x0-1, y0-1, x1+1, y1+1, 5, 50);
-  // Partition the map
-  partition.addPointObjects(map.landmark_list);
+  cout << "Particle kernels: " << ParticleKernels::instructionSet() << endl;
+  cout << "Distance kernels: " << DistanceKernels::instructionSet() << endl;
+
+  // Initialize the space partition, and partition the map
+  if (!tileDirectory.empty()) {
+    // Each frame partitions the tiles around the particles
+  } else if (!mapFileName.empty()) {
+    // The binary map file holds the partition
+  } else if (cellSize > 0) {
+    partition.initialize(x0-1, y0-1, x1+1, y1+1, cellSize, sensor_range);
+    partition.addPointObjects(map.landmark_list);
+  } else {
+    // Replay queries within a couple of meters of the landmarks, like observations of them
+    double cost = partition.autoConfigure(x0-1, y0-1, x1+1, y1+1, sensor_range, map.landmark_list, 1000, 2);
+    cout << "Expected query cost: " << cost << endl;
+  }
+  if (tileDirectory.empty()) {
+    cout << "Partition: cell size " << partition.cellSize() << " m, search distance " << partition.maxDistance()
+         << " m" << endl;
+  }
+  if (landmarkIndex == "kdtree") {
+    kdtree.initialize(partition.maxDistance());
+    kdtree.addPointObjects(map.landmark_list);
+  } else if (landmarkIndex == "quadtree") {
+    quadtree.initialize(partition.maxDistance());
+    quadtree.addPointObjects(map.landmark_list);
+    cout << "Quadtree: " << quadtree.nodeCount() << " nodes, depth " << quadtree.depth() << endl;
+  } else if (landmarkIndex == "sparse") {
+    sparse.initialize(partition.cellSize(), partition.maxDistance());
+    sparse.addPointObjects(map.landmark_list);
+    cout << "Sparse grid: " << sparse.cellCount() << " cells, " << sparse.memory() / 1048576. << " MB" << endl;
+  }
+  cout << "Landmark index: " << landmarkIndex << endl;
 
 #ifdef TEST_PARTITION
   // Test the 2D space partition algorithm
@@ -145,12 +332,112 @@ int main(int argc, char* argv[]) {
       cout << "Found no landmark!" << endl;
     }
   }
+
+  // The KD-tree must find the same landmarks as the partition
+  KDTree2D<Map::single_landmark_s> testTree;
+  testTree.initialize(50);
+  testTree.addPointObjects(map.landmark_list);
+  for (auto it = map.landmark_list.begin(); it != map.landmark_list.end(); it++) {
+    Map::single_landmark_s* nearest;
+    Map::single_landmark_s* expected;
+    double dist;
+    int searched;
+    std::tie(expected, dist, searched) = partition.findNearest(it->x() + 3, it->y() - 4);
+    std::tie(nearest, dist, searched) = testTree.findNearest(it->x() + 3, it->y() - 4);
+    if ((nearest? nearest->id(): -1) != (expected? expected->id(): -1)) {
+      cout << "KD-tree error at " << "(" << (it->x() + 3) << "," << (it->y() - 4) << ") got: "
+           << (nearest? nearest->id(): -1) << " expected: " << (expected? expected->id(): -1) << endl;
+    }
+  }
+
+  // The quadtree must find the same landmarks as the partition
+  QuadTree2D<Map::single_landmark_s> testQuadTree;
+  testQuadTree.initialize(50);
+  testQuadTree.addPointObjects(map.landmark_list);
+  for (auto it = map.landmark_list.begin(); it != map.landmark_list.end(); it++) {
+    Map::single_landmark_s* nearest;
+    Map::single_landmark_s* expected;
+    double dist;
+    int searched;
+    std::tie(expected, dist, searched) = partition.findNearest(it->x() - 6, it->y() + 5);
+    std::tie(nearest, dist, searched) = testQuadTree.findNearest(it->x() - 6, it->y() + 5);
+    if ((nearest? nearest->id(): -1) != (expected? expected->id(): -1)) {
+      cout << "Quadtree error at " << "(" << (it->x() - 6) << "," << (it->y() + 5) << ") got: "
+           << (nearest? nearest->id(): -1) << " expected: " << (expected? expected->id(): -1) << endl;
+    }
+  }
+
+  // The sparse grid must find the same landmarks as the partition
+  SparseGrid2D<Map::single_landmark_s> testSparse;
+  testSparse.initialize(partition.cellSize(), partition.maxDistance());
+  testSparse.addPointObjects(map.landmark_list);
+  for (auto it = map.landmark_list.begin(); it != map.landmark_list.end(); it++) {
+    Map::single_landmark_s* nearest;
+    Map::single_landmark_s* expected;
+    double dist;
+    int searched;
+    std::tie(expected, dist, searched) = partition.findNearest(it->x() + 4, it->y() + 8);
+    std::tie(nearest, dist, searched) = testSparse.findNearest(it->x() + 4, it->y() + 8);
+    if ((nearest? nearest->id(): -1) != (expected? expected->id(): -1)) {
+      cout << "Sparse grid error at " << "(" << (it->x() + 4) << "," << (it->y() + 8) << ") got: "
+           << (nearest? nearest->id(): -1) << " expected: " << (expected? expected->id(): -1) << endl;
+    }
+  }
+
+  // The k nearest landmarks and the landmarks within a radius must match a brute force search
+  for (auto it = map.landmark_list.begin(); it != map.landmark_list.end(); it++) {
+    const int k = 4;
+    const double radius = 30;
+    double x = it->x() + 7;
+    double y = it->y() + 2;
+    std::vector<double> expected;
+    for (auto other = map.landmark_list.begin(); other != map.landmark_list.end(); other++) {
+      expected.push_back(dist(x, y, other->x(), other->y()));
+    }
+    std::sort(expected.begin(), expected.end());
+    int index[k];
+    double distance[k];
+    int found = partition.findKNearest(x, y, k, index, distance);
+    for (int i = 0; i < found; i++) {
+      if (fabs(distance[i] - expected[i]) > 1.E-3) {
+        cout << "k-nearest error at " << "(" << x << "," << y << ") neighbor " << i << " got: " << distance[i]
+             << " expected: " << expected[i] << endl;
+      }
+    }
+    int within[64];
+    double withinDistance[64];
+    int count = partition.findWithin(x, y, radius, within, withinDistance, 64);
+    int expectedCount = std::upper_bound(expected.begin(), expected.end(), radius) - expected.begin();
+    if (count != expectedCount) {
+      cout << "Radius error at " << "(" << x << "," << y << ") got: " << count << " expected: " << expectedCount
+           << endl;
+    }
+  }
 #endif
 
   // Create particle filter
-  ParticleFilter pf(nParticles);
+  ThreadPool pool(nThreads);
+  ParticleFilter pf(nParticles, &pool, seed);
+  pf.setResamplingStrategy(resampling);
+  pf.setResamplingThreshold(resamplingThreshold);
+  kld.setBinSize(kldBins[0], kldBins[1], kldBins[2]);
+  pf.setKLDSampler(kld);
+  if (deadline > 0) {
+    int maxParticles = kldMaxParticles > 0? kldMaxParticles: nParticles;
+    pf.setLatencyBudget(LatencyBudget(deadline, std::min(minBudgetParticles, maxParticles), maxParticles));
+    cout << "Deadline: " << deadline << " ms" << endl;
+  }
+  cout << "Threads: " << pool.size() << endl;
+  if (landmarkIndex == "raster") {
+    raster.build(partition, rasterResolution, &pool);
+    cout << "Raster: " << rasterResolution << " m, " << raster.memory() / 1048576. << " MB" << endl;
+  }
+  if (measurementModel == "field") {
+    field.build(partition, fieldResolution, sigma_landmark, &pool);
+    cout << "Likelihood field: " << fieldResolution << " m, " << field.memory() / 1048576. << " MB" << endl;
+  }
 
-  h.onMessage([&pf, &partition, &delta_t, &sensor_range, &sigma_pos, &sigma_landmark](
+  h.onMessage([&pf, &partition, &kdtree, &quadtree, &sparse, &tiles, &tileDirectory, &raster, &landmarkIndex, &field, &measurementModel, &useLocalPartition, &delta_t, &sensor_range, &sigma_pos, &sigma_landmark](
       uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
       uWS::OpCode opCode) {
     // "42" at the start of the message means there's a websocket message event.
@@ -165,6 +452,7 @@ int main(int argc, char* argv[]) {
 
         if (event == "telemetry") {
           // j[1] is the data JSON object
+          LatencyBudget::Clock::time_point frameStart = LatencyBudget::Clock::now();
 
           if (!pf.initialized()) {
             // Sense noisy position data from the simulator
@@ -213,44 +501,71 @@ int main(int argc, char* argv[]) {
             noisy_observations.push_back(obs);
           }
 
-          // Update the weights and resample
-          pf.updateWeights(sensor_range, sigma_landmark, noisy_observations,
-                           partition);
+          // Update the weights and resample, the filter skips resampling while the effective sample size
+          // stays above the threshold
+          if (measurementModel == "field") {
+            pf.updateWeights(sensor_range, noisy_observations, field);
+          } else if (!tileDirectory.empty()) {
+            double bx0, by0, bx1, by1;
+            pf.bounds(bx0, by0, bx1, by1);
+            pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, tiles.partition(bx0, by0, bx1, by1));
+          } else if (landmarkIndex == "kdtree") {
+            pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, kdtree);
+          } else if (landmarkIndex == "quadtree") {
+            pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, quadtree);
+          } else if (landmarkIndex == "sparse") {
+            pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, sparse);
+          } else if (landmarkIndex == "raster") {
+            pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, raster);
+          } else if (useLocalPartition) {
+            pf.updateWeights(sensor_range, sigma_landmark, noisy_observations,
+                             pf.localPartition(partition, sensor_range + partition.maxDistance()));
+          } else {
+            pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, partition);
+          }
           pf.resample();
 
           // Calculate and output the average weighted error of the particle
           // filter over all time steps so far.
-          vector<Particle> particles = pf.particles;
+          const ParticleSet& particles = pf.getParticles();
           int num_particles = particles.size();
-          double highest_weight = -1.0;
-          Particle* best_particle;
           double weight_sum = 0.0;
-          for (int i = 0; i < num_particles; ++i) {
-            if (particles[i].weight > highest_weight) {
-              highest_weight = particles[i].weight;
-              best_particle = &particles[i];
-            }
-            weight_sum += particles[i].weight;
-          }
+          int best = pf.best(&weight_sum);
+          double highest_weight = particles.weight[best];
+          Particle best_particle = pf.getParticle(best);
           cout << "highest w " << highest_weight << endl;
           cout << "average w " << weight_sum / num_particles << endl;
+          cout << "particles " << num_particles << endl;
+          cout << "effective sample size " << pf.effectiveSampleSize() << endl;
           cout << "average landmark searched per observation: " << pf.averageSearch() << endl;
+          if (!tileDirectory.empty()) {
+            int hits, misses, prefetched;
+            tiles.statistics(hits, misses, prefetched);
+            cout << "tiles hit " << hits << ", missed " << misses << ", prefetched " << prefetched << endl;
+          }
+          if (pf.getLatencyBudget().enabled()) {
+            const LatencyBudget& budget = pf.getLatencyBudget();
+            cout << "observations used " << budget.plannedObservations(noisy_observations.size()) << " of "
+                 << noisy_observations.size() << ", predicted frame time "
+                 << budget.predicted(noisy_observations.size()) << " ms" << endl;
+          }
 
           json msgJson;
-          msgJson["best_particle_x"] = best_particle->x;
-          msgJson["best_particle_y"] = best_particle->y;
-          msgJson["best_particle_theta"] = best_particle->theta;
+          msgJson["best_particle_x"] = best_particle.x;
+          msgJson["best_particle_y"] = best_particle.y;
+          msgJson["best_particle_theta"] = best_particle.theta;
 
           // Optional message data used for debugging particle's sensing and
           // associations
           msgJson["best_particle_associations"] =
-              pf.getAssociations(*best_particle);
-          msgJson["best_particle_sense_x"] = pf.getSenseX(*best_particle);
-          msgJson["best_particle_sense_y"] = pf.getSenseY(*best_particle);
+              pf.getAssociations(best_particle);
+          msgJson["best_particle_sense_x"] = pf.getSenseX(best_particle);
+          msgJson["best_particle_sense_y"] = pf.getSenseY(best_particle);
 
           auto msg = "42[\"best_particle\"," + msgJson.dump() + "]";
           // std::cout << msg << std::endl;
           ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+          pf.endFrame(frameStart, noisy_observations.size());
         }
       } else {
         std::string msg = "42[\"manual\",{}]";
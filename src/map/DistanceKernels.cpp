@@ -0,0 +1,144 @@
+/*
+ * DistanceKernels.cpp
+ *
+ * Scalar, SSE2, and AVX2 implementations of the distance kernels, and their runtime selection.
+ */
+
+#include "DistanceKernels.h"
+#include "../utils/simd_math.h"
+
+namespace {
+
+typedef int (*NearestKernel)(const float *, const float *, int, float, float, float &);
+
+int nearestScalar(const float *x, const float *y, int n, float qx, float qy, float &min_dist2) {
+  int found = -1;
+  for (int i = 0; i < n; i++) {
+    float dx = x[i] - qx;
+    float dy = y[i] - qy;
+    float d = dx * dx + dy * dy;
+    if (d < min_dist2) {
+      min_dist2 = d;
+      found = i;
+    }
+  }
+  return found;
+}
+
+#ifdef PF_SIMD_X86
+/**
+ * Each lane keeps the nearest of the points it has seen, then the lanes are reduced, breaking ties by index
+ * so that the first nearest point wins like in the scalar kernel
+ * @param best the lanes' squared distances
+ * @param index the lanes' indices, -1 for lanes without a point
+ * @param lanes the number of lanes
+ * @param min_dist2 the squared distance to beat, updated to the nearest lane's squared distance
+ */
+int reduceLanes(const float *best, const int *index, int lanes, float &min_dist2) {
+  int found = -1;
+  for (int i = 0; i < lanes; i++) {
+    if (index[i] >= 0 && (best[i] < min_dist2 || (best[i] == min_dist2 && found >= 0 && index[i] < found))) {
+      min_dist2 = best[i];
+      found = index[i];
+    }
+  }
+  return found;
+}
+
+PF_TARGET_SSE2 int nearestSSE2(const float *x, const float *y, int n, float qx, float qy, float &min_dist2) {
+  int i = 0;
+  int found = -1;
+  if (n >= 4) {
+    __m128 vqx = _mm_set1_ps(qx);
+    __m128 vqy = _mm_set1_ps(qy);
+    __m128 best = _mm_set1_ps(min_dist2);
+    __m128i index = _mm_set1_epi32(-1);
+    __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i step = _mm_set1_epi32(4);
+    for (; i + 4 <= n; i += 4) {
+      __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), vqx);
+      __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), vqy);
+      __m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+      __m128 closer = _mm_cmplt_ps(d, best);
+      best = _mm_or_ps(_mm_and_ps(closer, d), _mm_andnot_ps(closer, best));
+      __m128i mask = _mm_castps_si128(closer);
+      index = _mm_or_si128(_mm_and_si128(mask, lane), _mm_andnot_si128(mask, index));
+      lane = _mm_add_epi32(lane, step);
+    }
+    float lane_best[4];
+    int lane_index[4];
+    _mm_storeu_ps(lane_best, best);
+    _mm_storeu_si128((__m128i *) lane_index, index);
+    found = reduceLanes(lane_best, lane_index, 4, min_dist2);
+  }
+  int rest = nearestScalar(x + i, y + i, n - i, qx, qy, min_dist2);
+  return rest >= 0? rest + i: found;
+}
+
+PF_TARGET_AVX2 int nearestAVX2(const float *x, const float *y, int n, float qx, float qy, float &min_dist2) {
+  int i = 0;
+  int found = -1;
+  if (n >= 8) {
+    __m256 vqx = _mm256_set1_ps(qx);
+    __m256 vqy = _mm256_set1_ps(qy);
+    __m256 best = _mm256_set1_ps(min_dist2);
+    __m256i index = _mm256_set1_epi32(-1);
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i step = _mm256_set1_epi32(8);
+    for (; i + 8 <= n; i += 8) {
+      __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), vqx);
+      __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), vqy);
+      __m256 d = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+      __m256 closer = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+      best = _mm256_blendv_ps(best, d, closer);
+      index = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(index), _mm256_castsi256_ps(lane),
+                                                   closer));
+      lane = _mm256_add_epi32(lane, step);
+    }
+    float lane_best[8];
+    int lane_index[8];
+    _mm256_storeu_ps(lane_best, best);
+    _mm256_storeu_si256((__m256i *) lane_index, index);
+    found = reduceLanes(lane_best, lane_index, 8, min_dist2);
+  }
+  int rest = nearestScalar(x + i, y + i, n - i, qx, qy, min_dist2);
+  return rest >= 0? rest + i: found;
+}
+#endif
+
+/**
+ * The kernels selected for the CPU we are running on
+ */
+struct Dispatch {
+  const char *name;
+  NearestKernel nearest;
+
+  Dispatch() {
+    name = "scalar";
+    nearest = nearestScalar;
+#ifdef PF_SIMD_X86
+    if (cpuSupportsAVX2()) {
+      name = "avx2";
+      nearest = nearestAVX2;
+    } else if (cpuSupportsSSE2()) {
+      name = "sse2";
+      nearest = nearestSSE2;
+    }
+#endif
+  }
+};
+
+const Dispatch &kernels() {
+  static Dispatch dispatch;
+  return dispatch;
+}
+
+}
+
+int DistanceKernels::nearestVector(const float *x, const float *y, int n, float qx, float qy, float &min_dist2) {
+  return kernels().nearest(x, y, n, qx, qy, min_dist2);
+}
+
+const char *DistanceKernels::instructionSet() {
+  return kernels().name;
+}
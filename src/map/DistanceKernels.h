@@ -0,0 +1,54 @@
+#ifndef _MAP_DISTANCEKERNELS_H_
+#define _MAP_DISTANCEKERNELS_H_
+
+/**
+ * Kernels scanning packed point coordinates for the point nearest to a query. Each kernel has a scalar, an
+ * SSE2, and an AVX2 implementation, the best one supported by the CPU is selected at runtime on first use.
+ */
+class DistanceKernels {
+  private:
+    // The minimum number of points worth calling the selected kernel for
+    static const int VECTOR_MIN = 8;
+
+    /**
+     * Find the nearest point with the kernel selected for the CPU, see nearest()
+     */
+    static int nearestVector(const float *x, const float *y, int n, float qx, float qy, float &min_dist2);
+
+  public:
+    /**
+     * Find the point nearest to a query among the points closer than a squared distance. Squared distances
+     * are compared, so no square root is taken. Among points at the same distance, the first one wins.
+     * @param x the points' x coordinates
+     * @param y the points' y coordinates
+     * @param n the number of points
+     * @param qx the query's x coordinate
+     * @param qy the query's y coordinate
+     * @param min_dist2 the squared distance to beat, updated to the nearest point's squared distance
+     * @return the index of the nearest point, or -1 if no point is closer than min_dist2
+     */
+    static int nearest(const float *x, const float *y, int n, float qx, float qy, float &min_dist2) {
+      // Most cells hold a few points, scanning them inline is cheaper than calling a vector kernel
+      if (n >= VECTOR_MIN) {
+        return nearestVector(x, y, n, qx, qy, min_dist2);
+      }
+      int found = -1;
+      for (int i = 0; i < n; i++) {
+        float dx = x[i] - qx;
+        float dy = y[i] - qy;
+        float d = dx * dx + dy * dy;
+        if (d < min_dist2) {
+          min_dist2 = d;
+          found = i;
+        }
+      }
+      return found;
+    }
+
+    /**
+     * @return the name of the instruction set used by the kernels: "avx2", "sse2", or "scalar"
+     */
+    static const char *instructionSet();
+};
+
+#endif
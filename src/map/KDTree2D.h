@@ -0,0 +1,258 @@
+#ifndef _MAP_KDTREE2D_H_
+#define _MAP_KDTREE2D_H_
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <tuple>
+#include "../utils/helper_functions.h"
+#include "DistanceKernels.h"
+
+/**
+ * A static 2D KD-tree of point objects, an alternative to Partition2D for maps with uneven point density,
+ * with the same query interface. The tree is implicit: the points are reordered so that the node of a range
+ * of points is the point in the middle of the range, with the points before it on one side of its splitting
+ * line and the points after it on the other. No child pointers are stored, and the points of a subtree are
+ * contiguous. Ranges of at most LEAF_SIZE points are leaves, scanned with DistanceKernels.
+ */
+template<typename T> class KDTree2D {
+  private:
+    // The maximum number of points of a leaf
+    static const int LEAF_SIZE = 8;
+
+    // The maximum depth of a tree, enough for any number of points that fits in an int
+    static const int MAX_DEPTH = 64;
+
+    // The points sorted in tree order
+    std::vector<float> point_x;
+    std::vector<float> point_y;
+    std::vector<T*> objects;
+
+    // The splitting axis of the node of each range's middle point, 0 for x, 1 for y
+    std::vector<uint8_t> axis;
+
+    // The maximum distance to search
+    float max_dist = 1.E10;
+
+    /**
+     * Build the subtree of a range of points
+     * @param begin the first point
+     * @param end the point after the last one
+     */
+    void build(int begin, int end) {
+      if (end - begin <= LEAF_SIZE) {
+        return;
+      }
+      // Split along the axis with the larger extent
+      float x0 = 1.E20, y0 = 1.E20, x1 = -1.E20, y1 = -1.E20;
+      for (int i = begin; i < end; i++) {
+        x0 = std::min(x0, point_x[i]);
+        x1 = std::max(x1, point_x[i]);
+        y0 = std::min(y0, point_y[i]);
+        y1 = std::max(y1, point_y[i]);
+      }
+      int split = x1 - x0 >= y1 - y0? 0: 1;
+      const std::vector<float> &key = split == 0? point_x: point_y;
+      int mid = (begin + end) / 2;
+      std::vector<int> order(end - begin);
+      for (int i = 0; i < end - begin; i++) {
+        order[i] = begin + i;
+      }
+      std::nth_element(order.begin(), order.begin() + (mid - begin), order.end(),
+                       [&key](int a, int b) { return key[a] < key[b]; });
+      permute(begin, order);
+      axis[mid] = split;
+      build(begin, mid);
+      build(mid + 1, end);
+    }
+
+    /**
+     * Reorder a range of points
+     * @param begin the first point of the range
+     * @param order the points to place at begin, begin + 1, ...
+     */
+    void permute(int begin, const std::vector<int> &order) {
+      int n = order.size();
+      std::vector<float> xs(n);
+      std::vector<float> ys(n);
+      std::vector<T*> objs(n);
+      for (int i = 0; i < n; i++) {
+        xs[i] = point_x[order[i]];
+        ys[i] = point_y[order[i]];
+        objs[i] = objects[order[i]];
+      }
+      std::copy(xs.begin(), xs.end(), point_x.begin() + begin);
+      std::copy(ys.begin(), ys.end(), point_y.begin() + begin);
+      std::copy(objs.begin(), objs.end(), objects.begin() + begin);
+    }
+
+    /**
+     * Find the nearest point in the tree
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @param min_dist the squared distance to beat, updated to the nearest point's squared distance
+     * @param searched receives the number of points searched
+     * @return the index of the nearest point, or -1 if no point is closer than min_dist
+     */
+    int nearest(float x, float y, float &min_dist, int &searched) const {
+      // Subtrees still to visit, with the squared distance of their side of the splitting line
+      int stack_begin[MAX_DEPTH];
+      int stack_end[MAX_DEPTH];
+      float stack_dist[MAX_DEPTH];
+      int top = 0;
+      int found = -1;
+      int begin = 0;
+      int end = objects.size();
+      searched = 0;
+      if (objects.empty()) {
+        return found;
+      }
+      while (true) {
+        if (end - begin <= LEAF_SIZE) {
+          int k = DistanceKernels::nearest(&point_x[begin], &point_y[begin], end - begin, x, y, min_dist);
+          if (k >= 0) {
+            found = begin + k;
+          }
+          searched += end - begin;
+          // Continue with the innermost subtree that can still hold a closer point
+          do {
+            if (top == 0) {
+              return found;
+            }
+            top--;
+          } while (stack_dist[top] >= min_dist);
+          begin = stack_begin[top];
+          end = stack_end[top];
+          continue;
+        }
+        int mid = (begin + end) / 2;
+        float d = axis[mid] == 0? x - point_x[mid]: y - point_y[mid];
+        float dx = x - point_x[mid];
+        float dy = y - point_y[mid];
+        float node_dist = dx * dx + dy * dy;
+        searched++;
+        if (node_dist < min_dist) {
+          min_dist = node_dist;
+          found = mid;
+        }
+        // Descend into the near side first, the far side is visited later if it can still be closer
+        if (d < 0) {
+          stack_begin[top] = mid + 1;
+          stack_end[top] = end;
+          end = mid;
+        } else {
+          stack_begin[top] = begin;
+          stack_end[top] = mid;
+          begin = mid + 1;
+        }
+        stack_dist[top++] = d * d;
+      }
+    }
+
+  public:
+    KDTree2D() {}
+
+    /**
+     * Initialize the tree
+     * @param max_dist the maximum distance to search
+     */
+    void initialize(float max_dist) {
+      this->max_dist = max_dist;
+      clear();
+    }
+
+    /**
+     * Clear the tree
+     */
+    void clear() {
+      point_x.clear();
+      point_y.clear();
+      objects.clear();
+      axis.clear();
+    }
+
+    /**
+     * @return the number of objects in the tree
+     */
+    int size() const {
+      return objects.size();
+    }
+
+    /**
+     * Find the nearest object to the given coordinate within the maximum distance
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @return pointer to the closest object or null if none is found, its distance, and the number of objects
+     *   searched
+     */
+    std::tuple<T*, double, int> findNearest(double x, double y) const {
+      float min_dist = max_dist * max_dist;
+      int searched;
+      int found = nearest(x, y, min_dist, searched);
+      return std::make_tuple(found >= 0? objects[found]: NULL, found >= 0? sqrt(min_dist): -1, searched);
+    }
+
+    /**
+     * Find the nearest objects to a batch of coordinates within the maximum distance. Nearby coordinates
+     * visit the same nodes, which stay in cache from one query to the next.
+     * @param x the x coordinates
+     * @param y the y coordinates
+     * @param n the number of coordinates
+     * @param index receives the index of the closest object of each coordinate, -1 if none is found, see
+     *   object(), pointX(), and pointY()
+     * @param distance receives the distance to the closest object of each coordinate, -1 if none is found
+     * @param searched if not NULL, receives the number of objects searched for each coordinate
+     */
+    void findNearestBatch(const double *x, const double *y, int n, int *index, double *distance,
+                          int *searched = NULL) const {
+      for (int q = 0; q < n; q++) {
+        float min_dist = max_dist * max_dist;
+        int count;
+        index[q] = nearest(x[q], y[q], min_dist, count);
+        distance[q] = index[q] >= 0? sqrt(min_dist): -1;
+        if (searched) {
+          searched[q] = count;
+        }
+      }
+    }
+
+    /**
+     * Get an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    T *object(int index) const {
+      return objects[index];
+    }
+
+    /**
+     * Get the x coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointX(int index) const {
+      return point_x[index];
+    }
+
+    /**
+     * Get the y coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointY(int index) const {
+      return point_y[index];
+    }
+
+    /** Add point objects, and rebuild the tree. A point object has x and y coordinate, and provides accessor
+     * x() and y().
+     * @param objects the objects
+     */
+    void addPointObjects(std::vector<T> &objects) {
+      for (size_t i = 0; i < objects.size(); i++) {
+        point_x.push_back(objects[i].x());
+        point_y.push_back(objects[i].y());
+        this->objects.push_back(&objects[i]);
+      }
+      axis.assign(this->objects.size(), 0);
+      build(0, this->objects.size());
+    }
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _MAP_LANDMARKINDEX_H_
+#define _MAP_LANDMARKINDEX_H_
+#include <type_traits>
+#include <utility>
+#include "Map.h"
+
+/**
+ * Compile-time check that a type can serve as the landmark index of ParticleFilter::updateWeights(). A
+ * landmark index provides, like Partition2D and KDTree2D:
+ *
+ *   void findNearestBatch(const double *x, const double *y, int n, int *index, double *distance,
+ *                         int *searched) const;
+ *   Map::single_landmark_s *object(int index) const;
+ *   float pointX(int index) const;
+ *   float pointY(int index) const;
+ *
+ * The index is a template parameter of the filter, so its functions are called directly, and can be inlined
+ * into the update loop.
+ */
+template<typename Index> class LandmarkIndex {
+  private:
+    template<typename I> static auto test(int) -> decltype(
+        std::declval<const I &>().findNearestBatch((const double *) 0, (const double *) 0, 0, (int *) 0,
+                                                   (double *) 0, (int *) 0),
+        std::declval<Map::single_landmark_s *&>() = std::declval<const I &>().object(0),
+        std::declval<float &>() = std::declval<const I &>().pointX(0),
+        std::declval<float &>() = std::declval<const I &>().pointY(0),
+        std::true_type());
+
+    template<typename I> static std::false_type test(...);
+
+  public:
+    // Whether Index provides the functions of a landmark index
+    static const bool value = decltype(test<Index>(0))::value;
+};
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * MapFile.cpp
+ *
+ * Memory-mapped binary map files.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <vector>
+#include "MapFile.h"
+
+const char MapFile::MAGIC[8] = {'P', 'F', 'M', 'A', 'P', 0, 0, 0};
+
+namespace {
+
+/**
+ * Get the offsets of the arrays following the header, and the size of a file
+ */
+void layout(const MapFile::Header &header, size_t &landmarks, size_t &cells, size_t &point_x, size_t &point_y,
+            size_t &size) {
+  landmarks = sizeof(MapFile::Header);
+  cells = landmarks + size_t(header.landmarks) * header.landmark_size;
+  point_x = cells + (size_t(header.dim_x) * header.dim_y + 1) * sizeof(int32_t);
+  point_y = point_x + size_t(header.landmarks) * sizeof(float);
+  size = point_y + size_t(header.landmarks) * sizeof(float);
+}
+
+/**
+ * Check the header's fields against each other and against the build, before any array is located
+ */
+bool validHeader(const MapFile::Header &header) {
+  return memcmp(header.magic, MapFile::MAGIC, sizeof(MapFile::MAGIC)) == 0 && header.version == MapFile::VERSION &&
+      header.landmark_size == sizeof(MapFile::Landmark) && header.landmarks >= 0 && header.cell_size > 0 &&
+      header.max_dist >= 0 && header.world_x0 < header.world_x1 && header.world_y0 < header.world_y1 &&
+      header.dim_x == std::ceil((header.world_x1 - header.world_x0) / header.cell_size) &&
+      header.dim_y == std::ceil((header.world_y1 - header.world_y0) / header.cell_size);
+}
+
+/**
+ * Check that the cells' starts are in order and cover the landmarks, so that no cell's range leaves the arrays
+ */
+bool validCells(const MapFile::Header &header, const int32_t *cell_start) {
+  size_t cells = size_t(header.dim_x) * header.dim_y;
+  if (cell_start[0] != 0 || cell_start[cells] != header.landmarks) {
+    return false;
+  }
+  for (size_t i = 0; i < cells; i++) {
+    if (cell_start[i] > cell_start[i + 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+MapFile::~MapFile() {
+  close();
+}
+
+bool MapFile::write(const std::string &file, const Partition2D<Landmark> &partition) {
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.landmark_size = sizeof(Landmark);
+  header.landmarks = partition.size();
+  partition.bounds(header.world_x0, header.world_y0, header.world_x1, header.world_y1);
+  header.cell_size = partition.cellSize();
+  header.max_dist = partition.maxDistance();
+  header.dim_x = std::ceil((header.world_x1 - header.world_x0) / header.cell_size);
+  header.dim_y = std::ceil((header.world_y1 - header.world_y0) / header.cell_size);
+  if (header.dim_x * header.dim_y != partition.cellCount()) {
+    return false;
+  }
+
+  std::vector<Landmark> landmarks(header.landmarks);
+  std::vector<float> point_x(header.landmarks);
+  std::vector<float> point_y(header.landmarks);
+  for (int k = 0; k < header.landmarks; k++) {
+    landmarks[k] = *partition.object(k);
+    point_x[k] = partition.pointX(k);
+    point_y[k] = partition.pointY(k);
+  }
+  std::ofstream out(file.c_str(), std::ios::binary);
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)landmarks.data(), landmarks.size() * sizeof(Landmark));
+  out.write((const char*)partition.cellStarts(), (partition.cellCount() + 1) * sizeof(int32_t));
+  out.write((const char*)point_x.data(), point_x.size() * sizeof(float));
+  out.write((const char*)point_y.data(), point_y.size() * sizeof(float));
+  return bool(out);
+}
+
+bool MapFile::open(const std::string &file, Partition2D<Landmark> &partition) {
+  close();
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || size_t(status.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+  // Mapped copy-on-write, so that the landmarks can be handed out as non-const like a Map's
+  data = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    data = NULL;
+    return false;
+  }
+  length = status.st_size;
+
+  const Header &header = *(const Header*)data;
+  if (!validHeader(header)) {
+    close();
+    return false;
+  }
+  size_t landmarks, cells, point_x, point_y, size;
+  layout(header, landmarks, cells, point_x, point_y, size);
+  char *base = (char*)data;
+  if (size != length || !validCells(header, (const int32_t*)(base + cells))) {
+    close();
+    return false;
+  }
+  partition.view(header.world_x0, header.world_y0, header.world_x1, header.world_y1, header.cell_size,
+                 header.max_dist, (const int*)(base + cells), (const float*)(base + point_x),
+                 (const float*)(base + point_y), (Landmark*)(base + landmarks), header.landmarks);
+  return true;
+}
+
+void MapFile::close() {
+  if (data) {
+    munmap(data, length);
+    data = NULL;
+    length = 0;
+  }
+}
+
+MapFile::Landmark *MapFile::landmarks() const {
+  return data? (Landmark*)((char*)data + sizeof(Header)): NULL;
+}
+
+int MapFile::size() const {
+  return data? ((const Header*)data)->landmarks: 0;
+}
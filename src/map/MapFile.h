@@ -0,0 +1,94 @@
+#ifndef _MAP_MAPFILE_H_
+#define _MAP_MAPFILE_H_
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Map.h"
+#include "Partition2D.h"
+
+/**
+ * A binary map file holding the landmarks and their Partition2D, memory mapped and searched in place, so that
+ * opening a map involves no parsing nor index construction. The file is written by convert_map in the native
+ * byte order, and holds:
+ * - a Header
+ * - the landmarks sorted by cell, as Map::single_landmark_s
+ * - the start of each cell's landmarks, the number of cells plus one int32
+ * - the x coordinates of the landmarks, then their y coordinates, as floats
+ * The file is mapped copy-on-write, the landmarks can be used like the ones of a Map.
+ */
+class MapFile {
+  public:
+    typedef Map::single_landmark_s Landmark;
+
+    /**
+     * The header of a map file
+     */
+    struct Header {
+      // MAGIC, and VERSION of the format
+      char magic[8];
+      uint32_t version;
+
+      // sizeof(Landmark) of the writer, a file is only read by a build with the same landmark layout
+      uint32_t landmark_size;
+
+      // The number of landmarks
+      int32_t landmarks;
+
+      // The partition's world, cells, and search distance
+      int32_t dim_x;
+      int32_t dim_y;
+      float world_x0;
+      float world_y0;
+      float world_x1;
+      float world_y1;
+      float cell_size;
+      float max_dist;
+      int32_t reserved;
+    };
+
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 1;
+
+  private:
+    // The mapped file
+    void *data = NULL;
+    size_t length = 0;
+
+  public:
+    MapFile() {}
+
+    ~MapFile();
+
+    /**
+     * Write a partition and its landmarks to a map file
+     * @param file the name of the file
+     * @param partition the partition
+     * @return false if the file can not be written
+     */
+    static bool write(const std::string &file, const Partition2D<Landmark> &partition);
+
+    /**
+     * Map a map file, and make a partition a view of it
+     * @param file the name of the file
+     * @param partition receives the partition of the file's landmarks, valid while the file is open
+     * @return false if the file can not be read or is not a valid map file
+     */
+    bool open(const std::string &file, Partition2D<Landmark> &partition);
+
+    /**
+     * Unmap the file
+     */
+    void close();
+
+    /**
+     * @return the landmarks, sorted by cell
+     */
+    Landmark *landmarks() const;
+
+    /**
+     * @return the number of landmarks
+     */
+    int size() const;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef _MAP_NEARESTRASTER_H_
+#define _MAP_NEARESTRASTER_H_
+#include <math.h>
+#include <vector>
+#include <tuple>
+#include "Partition2D.h"
+#include "../utils/ThreadPool.h"
+
+/**
+ * A precomputed nearest object lookup table over a Partition2D, for static maps. The partition's world is
+ * rasterized at a given resolution, and each raster cell holds the index of the object nearest to its center,
+ * so finding the nearest object is a single table lookup. This is a discrete Voronoi diagram of the objects:
+ * near the boundary between two objects' regions, within half a cell, the object found may be the second
+ * nearest. Coordinates outside of the world fall back to searching the partition. The index has the same
+ * query interface as Partition2D, and refers to the partition's objects.
+ */
+template<typename T> class NearestRaster {
+  private:
+    // The partition the table was built from
+    const Partition2D<T> *partition = NULL;
+
+    // The raster's origin, and cell size
+    float x0 = 0;
+    float y0 = 0;
+    float resolution = 1;
+
+    // The dimension of the raster
+    int dim_x = 0;
+    int dim_y = 0;
+
+    // The index in the partition of the object nearest to each cell's center, -1 if there is none within the
+    // partition's search distance, row by row
+    std::vector<int> table;
+
+    /**
+     * Get the raster cell of a coordinate
+     * @return the cell's index, or -1 if the coordinate is outside of the raster
+     */
+    long cellOf(double x, double y) const {
+      int cx = std::floor((x - x0) / resolution);
+      int cy = std::floor((y - y0) / resolution);
+      if (cx < 0 || cy < 0 || cx >= dim_x || cy >= dim_y) {
+        return -1;
+      }
+      return cx + long(cy) * dim_x;
+    }
+
+  public:
+    NearestRaster() {}
+
+    /**
+     * Build the table. The rows are filled in parallel, each row finding the nearest objects of its cells'
+     * centers with one batched partition query.
+     * @param partition the partition holding the objects, it must outlive the table
+     * @param resolution the width and height of raster cells
+     * @param pool worker threads to fill the table with, or NULL to fill it on the calling thread
+     */
+    void build(const Partition2D<T> &partition, float resolution, ThreadPool *pool = NULL) {
+      float x1, y1;
+      partition.bounds(x0, y0, x1, y1);
+      this->partition = &partition;
+      this->resolution = resolution;
+      dim_x = std::ceil((x1 - x0) / resolution);
+      dim_y = std::ceil((y1 - y0) / resolution);
+      table.assign(long(dim_x) * dim_y, -1);
+      ThreadPool::Job fill = [&](int begin, int end, int part) {
+        std::vector<double> xs(dim_x);
+        std::vector<double> ys(dim_x);
+        std::vector<double> distance(dim_x);
+        for (int j = begin; j < end; j++) {
+          for (int i = 0; i < dim_x; i++) {
+            xs[i] = x0 + (i + 0.5) * resolution;
+            ys[i] = y0 + (j + 0.5) * resolution;
+          }
+          partition.findNearestBatch(xs.data(), ys.data(), dim_x, &table[long(j) * dim_x], distance.data());
+        }
+      };
+      if (pool) {
+        pool->parallelFor(0, dim_y, fill);
+      } else {
+        fill(0, dim_y, 0);
+      }
+    }
+
+    /**
+     * @return the memory used by the table [bytes]
+     */
+    size_t memory() const {
+      return table.size() * sizeof(int);
+    }
+
+    /**
+     * Find the nearest object to the given coordinate
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @return pointer to the closest object or null if none is found, its distance, and the number of objects
+     *   searched
+     */
+    std::tuple<T*, double, int> findNearest(double x, double y) const {
+      long cell = cellOf(x, y);
+      if (cell < 0) {
+        return partition->findNearest(x, y);
+      }
+      int k = table[cell];
+      if (k < 0) {
+        return std::make_tuple((T*) NULL, -1., 0);
+      }
+      return std::make_tuple(partition->object(k), dist(x, y, pointX(k), pointY(k)), 1);
+    }
+
+    /**
+     * Find the nearest objects to a batch of coordinates
+     * @param x the x coordinates
+     * @param y the y coordinates
+     * @param n the number of coordinates
+     * @param index receives the index of the closest object of each coordinate, -1 if none is found, see
+     *   object(), pointX(), and pointY()
+     * @param distance receives the distance to the closest object of each coordinate, -1 if none is found
+     * @param searched if not NULL, receives the number of objects searched for each coordinate
+     */
+    void findNearestBatch(const double *x, const double *y, int n, int *index, double *distance,
+                          int *searched = NULL) const {
+      for (int q = 0; q < n; q++) {
+        long cell = cellOf(x[q], y[q]);
+        int count = 1;
+        if (cell >= 0) {
+          index[q] = table[cell];
+        } else {
+          partition->findNearestBatch(x + q, y + q, 1, index + q, distance + q, &count);
+        }
+        distance[q] = index[q] >= 0? dist(x[q], y[q], pointX(index[q]), pointY(index[q])): -1;
+        if (searched) {
+          searched[q] = count;
+        }
+      }
+    }
+
+    /**
+     * Get an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    T *object(int index) const {
+      return partition->object(index);
+    }
+
+    /**
+     * Get the x coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointX(int index) const {
+      return partition->pointX(index);
+    }
+
+    /**
+     * Get the y coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointY(int index) const {
+      return partition->pointY(index);
+    }
+};
+
+#endif
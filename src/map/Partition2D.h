@@ -1,12 +1,16 @@
 #ifndef _MAP_PARTITION2D_H_
 #define _MAP_PARTITION2D_H_
 #include <math.h>
+#include <stdint.h>
+#include <algorithm>
 #include <vector>
 #include <tuple>
+#include <random>
 #include <iostream>
 #include <assert.h>
 #include "../utils/helper_functions.h"
 #include "Map.h"
+#include "DistanceKernels.h"
 
 template<typename T> class Partition2D {
   private:
@@ -25,19 +29,227 @@ template<typename T> class Partition2D {
 
     float cell_size;
 
-    // The partition structure
-    std::vector<std::vector<T*>*> cells;
+    // The partition structure, in compressed sparse row layout: the points of cell i are stored at
+    // [cell_start[i], cell_start[i + 1]) of point_x, point_y, and objects, so a cell's points are contiguous
+    std::vector<int> cell_start;
+    std::vector<float> point_x;
+    std::vector<float> point_y;
+    std::vector<T*> objects;
+
+    // The arrays searched: the vectors' data, or the arrays of a serialized partition, see view()
+    const int *cell_data = NULL;
+    const float *x_data = NULL;
+    const float *y_data = NULL;
+
+    // The objects of a view, sorted by cell, NULL if the partition owns its arrays
+    T *view_objects = NULL;
+    int view_size = 0;
+
+    // The cost of visiting a cell, relative to comparing the distance of an object, for autoConfigure()
+    static constexpr double CELL_COST = 8;
+
+    // The number of bits of the cell keys sorted by each pass of findNearestBatch()'s radix sort
+    static const int RADIX_BITS = 8;
+
+    /**
+     * The scratch buffers of findNearestBatch(), one per thread, grown to the largest batch and then reused
+     */
+    struct BatchScratch {
+      std::vector<uint32_t> cell;
+      std::vector<int> order;
+      std::vector<int> sorted;
+      std::vector<float> min_dist;
+      std::vector<int> count;
+      std::vector<int> active;
+      std::vector<int> scan;
+
+      void reserve(int n) {
+        if (int(cell.size()) < n) {
+          cell.resize(n);
+          order.resize(n);
+          sorted.resize(n);
+          min_dist.resize(n);
+          count.resize(n);
+          active.resize(n);
+          scan.resize(n);
+        }
+      }
+    };
+
+    /**
+     * Point the arrays searched to the vectors, after they change
+     */
+    void attach() {
+      cell_data = cell_start.data();
+      x_data = point_x.data();
+      y_data = point_y.data();
+      view_objects = NULL;
+      view_size = 0;
+    }
+
+    /**
+     * Set the world and the cells
+     */
+    void configure(float x0, float y0, float x1, float y1, float cell_size, float max_dist) {
+      world_x0 = x0;
+      world_y0 = y0;
+      world_x1 = x1;
+      world_y1 = y1;
+      this->cell_size = cell_size;
+      assert(x0 < x1 && y0 < y1);
+      assert(cell_size > 0);
+      this->dim_x = std::ceil((x1 - x0) / cell_size);
+      this->dim_y = std::ceil((y1 - y0) / cell_size);
+      search_levels = max_dist / cell_size + 0.5;
+    }
 
   protected:
     int cellIndex(int x, int y) const {
       return x + y * dim_x;
     }
 
+    /**
+     * Get the index of the cell containing a point, points outside of the world go to the closest cell
+     */
+    int cellOf(float x, float y) const {
+      int idx_x = std::min(dim_x - 1, std::max(0, int((x - world_x0) / cell_size)));
+      int idx_y = std::min(dim_y - 1, std::max(0, int((y - world_y0) / cell_size)));
+      return cellIndex(idx_x, idx_y);
+    }
+
+    /**
+     * Get the squared distance from a point to the closest point of a cell
+     */
+    double cellDistance2(int i, int j, double x, double y) const {
+      double left = world_x0 + i * cell_size;
+      double bottom = world_y0 + j * cell_size;
+      double dx = std::max(0., std::max(left - x, x - (left + cell_size)));
+      double dy = std::max(0., std::max(bottom - y, y - (bottom + cell_size)));
+      return dx * dx + dy * dy;
+    }
+
+    /**
+     * Get the distance from a point to the border of the window covered by the rings of cells around a
+     * cell below a level, no object of the ring at the level can be closer
+     * @param cx the x index of the ring's center cell
+     * @param cy the y index of the ring's center cell
+     * @param level the level of the ring, at least 1
+     * @param x the x coordinate of the point
+     * @param y the y coordinate of the point
+     * @param covers receives true if the window covers the world, there is nothing left to search then
+     */
+    double ringDistance(int cx, int cy, int level, double x, double y, bool &covers) const {
+      int x0 = cx - level + 1;
+      int y0 = cy - level + 1;
+      int x1 = cx + level;
+      int y1 = cy + level;
+      covers = x0 <= 0 && y0 <= 0 && x1 >= dim_x && y1 >= dim_y;
+      return std::min(std::min(x - (world_x0 + x0 * cell_size), (world_x0 + x1 * cell_size) - x),
+                      std::min(y - (world_y0 + y0 * cell_size), (world_y0 + y1 * cell_size) - y));
+    }
+
+    /**
+     * Call a function with the index of each cell of a ring that lies in the world
+     * @param cx the x index of the ring's center cell
+     * @param cy the y index of the ring's center cell
+     * @param level the level of the ring, 0 is the center cell itself
+     * @param f the function, called with the x and y index of the cell
+     */
+    template<typename F> void forEachRingCell(int cx, int cy, int level, F f) const {
+      int x0 = std::max(0, cx - level);
+      int x1 = std::min(dim_x - 1, cx + level);
+      int y0 = std::max(0, cy - level);
+      int y1 = std::min(dim_y - 1, cy + level);
+      for (int j = y0; j <= y1; j++) {
+        if (j == cy - level || j == cy + level) {
+          for (int i = x0; i <= x1; i++) {
+            f(i, j);
+          }
+        } else { // inner rows only have the ring's two side cells
+          if (cx - level >= x0 && cx - level <= x1) {
+            f(cx - level, j);
+          }
+          if (level > 0 && cx + level >= x0 && cx + level <= x1) {
+            f(cx + level, j);
+          }
+        }
+      }
+    }
+
+    /**
+     * Move a heap entry up until its parent is farther, the heap is a max-heap of squared distances
+     * @param index the objects' indices
+     * @param distance the objects' squared distances
+     * @param i the entry
+     */
+    static void siftUp(int *index, double *distance, int i) {
+      while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (distance[parent] >= distance[i]) {
+          break;
+        }
+        std::swap(index[parent], index[i]);
+        std::swap(distance[parent], distance[i]);
+        i = parent;
+      }
+    }
+
+    /**
+     * Move a heap entry down until its children are closer
+     * @param index the objects' indices
+     * @param distance the objects' squared distances
+     * @param i the entry
+     * @param n the size of the heap
+     */
+    static void siftDown(int *index, double *distance, int i, int n) {
+      while (true) {
+        int largest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < n && distance[left] > distance[largest]) {
+          largest = left;
+        }
+        if (right < n && distance[right] > distance[largest]) {
+          largest = right;
+        }
+        if (largest == i) {
+          break;
+        }
+        std::swap(index[largest], index[i]);
+        std::swap(distance[largest], distance[i]);
+        i = largest;
+      }
+    }
+
   public:
     Partition2D() {}
-    
-    ~Partition2D() {
-      cells.clear();
+
+    Partition2D(const Partition2D &other) {
+      *this = other;
+    }
+
+    Partition2D &operator=(const Partition2D &other) {
+      world_x0 = other.world_x0;
+      world_y0 = other.world_y0;
+      world_x1 = other.world_x1;
+      world_y1 = other.world_y1;
+      search_levels = other.search_levels;
+      dim_x = other.dim_x;
+      dim_y = other.dim_y;
+      cell_size = other.cell_size;
+      cell_start = other.cell_start;
+      point_x = other.point_x;
+      point_y = other.point_y;
+      objects = other.objects;
+      attach();
+      if (other.view_objects) { // a view shares the serialized arrays
+        cell_data = other.cell_data;
+        x_data = other.x_data;
+        y_data = other.y_data;
+        view_objects = other.view_objects;
+        view_size = other.view_size;
+      }
+      return *this;
     }
 
     /**
@@ -50,101 +262,572 @@ template<typename T> class Partition2D {
      * @param max_dist the maximum distance to search
      */ 
     void initialize(float x0, float y0, float x1, float y1, float cell_size, float max_dist) {
-      world_x0 = x0;
-      world_y0 = y0;
-      world_x1 = x1;
-      world_y1 = y1;
-      this->cell_size = cell_size;
-      assert(x0 < x1 && y0 < y1);
-      assert(cell_size > 0);
-      this->dim_x = std::ceil((x1 - x0) / cell_size);
-      this->dim_y = std::ceil((y1 - y0) / cell_size);
-      search_levels = max_dist / cell_size + 0.5;
-      cells.clear();
-      cells.resize(dim_x * dim_y, NULL);
+      configure(x0, y0, x1, y1, cell_size, max_dist);
+      clear();
+    }
+
+    /**
+     * Make the partition a read-only view of arrays serialized from another partition, see MapFile. The
+     * arrays are searched in place, and must outlive the view. initialize() or clear() make the partition
+     * own its arrays again.
+     * @param x0 the left coordinate of the world
+     * @param y0 the lower coordinate of the world
+     * @param x1 the right coordinate of the world
+     * @param y1 the upper coordinate of the world
+     * @param cell_size the width and height of cells
+     * @param max_dist the maximum distance to search
+     * @param cell_start the start of each cell's objects, the number of cells plus one long, see cellStarts()
+     * @param point_x the x coordinates of the objects sorted by cell
+     * @param point_y the y coordinates of the objects sorted by cell
+     * @param objects the objects sorted by cell
+     * @param size the number of objects
+     */
+    void view(float x0, float y0, float x1, float y1, float cell_size, float max_dist, const int *cell_start,
+              const float *point_x, const float *point_y, T *objects, int size) {
+      configure(x0, y0, x1, y1, cell_size, max_dist);
+      std::vector<int>().swap(this->cell_start);
+      std::vector<float>().swap(this->point_x);
+      std::vector<float>().swap(this->point_y);
+      std::vector<T*>().swap(this->objects);
+      cell_data = cell_start;
+      x_data = point_x;
+      y_data = point_y;
+      view_objects = objects;
+      view_size = size;
+    }
+
+    /**
+     * Initialize the partition with the cell size that minimizes the expected cost of a query, and add the
+     * objects. The candidate cell sizes range from a quarter to 4 times the mean spacing of the objects, but
+     * the grid has no more than 2 cells per object, or 1024 cells. The cost of a query is the number of cells
+     * it visits, weighted by CELL_COST, plus the number of objects it compares. Without samples, it is
+     * estimated from the mean density of the objects, which suits evenly spread objects. With samples, queries
+     * near the objects are replayed on each candidate, which accounts for clusters and empty areas. The search
+     * distance is rounded up to a whole number of cells.
+     * @param x0 the left coordinate of the world
+     * @param y0 the lower coordinate of the world
+     * @param x1 the right coordinate of the world
+     * @param y1 the upper coordinate of the world
+     * @param max_dist the minimum distance to search
+     * @param objects the objects
+     * @param samples the number of queries to replay, 0 to estimate the cost from the density
+     * @param jitter the maximum x and y offset of the replayed queries from the objects
+     * @return the expected cost of a query with the chosen cell size
+     */
+    double autoConfigure(float x0, float y0, float x1, float y1, float max_dist, std::vector<T> &objects,
+                         int samples = 0, float jitter = 0) {
+      double area = double(x1 - x0) * (y1 - y0);
+      int n = std::max<int>(1, objects.size());
+      double spacing = sqrt(area / n);
+      // Sample queries around objects picked at random, with a fixed seed for repeatable choices
+      std::vector<double> query_x;
+      std::vector<double> query_y;
+      if (!objects.empty()) {
+        std::mt19937 random(1);
+        std::uniform_int_distribution<int> pick(0, objects.size() - 1);
+        std::uniform_real_distribution<double> offset(-jitter, jitter);
+        for (int q = 0; q < samples; q++) {
+          T &object = objects[pick(random)];
+          query_x.push_back(object.x() + offset(random));
+          query_y.push_back(object.y() + offset(random));
+        }
+      }
+      // Bound the grid to a couple of cells per object, larger grids miss the cache. On a large sparse world,
+      // the candidates below the bound all become the bound.
+      double min_size = sqrt(area / std::max(1024, 2 * n));
+      double best_cost = -1;
+      float best_size = max_dist;
+      float last_size = 0;
+      for (int k = -4; k <= 4; k++) {
+        float size = std::max<double>(std::min<double>(spacing * pow(2, k / 2.), max_dist), min_size);
+        if (size == last_size) {
+          continue;
+        }
+        last_size = size;
+        int levels = std::ceil(max_dist / size);
+        double cost = 0;
+        if (query_x.empty()) {
+          // The expected distance to the nearest of uniformly spread objects is half their spacing
+          int rings = std::min(levels, 1 + int(std::ceil(0.5 * spacing / size)));
+          double cells = square(2 * rings - 1);
+          cost = cells * (CELL_COST + double(size) * size / square(spacing));
+        } else {
+          initialize(x0, y0, x1, y1, size, levels * size);
+          addPointObjects(objects);
+          for (size_t q = 0; q < query_x.size(); q++) {
+            T *nearest;
+            double distance;
+            int searched;
+            std::tie(nearest, distance, searched) = findNearest(query_x[q], query_y[q]);
+            int rings = nearest? std::min(levels, 1 + int(std::ceil(distance / size))): levels;
+            cost += square(2 * rings - 1) * CELL_COST + searched;
+          }
+          cost /= query_x.size();
+        }
+        if (best_cost < 0 || cost < best_cost) {
+          best_cost = cost;
+          best_size = size;
+        }
+      }
+      initialize(x0, y0, x1, y1, best_size, std::ceil(max_dist / best_size) * best_size);
+      addPointObjects(objects);
+      return best_cost;
     }
 
     /**
      * Clear the partition
      */ 
     void clear() {
-      for (int i = 0; i < cells.size(); i++) {
-        if (cells[i]) {
-          delete cells[i];
-        }
-      }
-      cells.clear();
+      cell_start.assign(dim_x * dim_y + 1, 0);
+      point_x.clear();
+      point_y.clear();
+      objects.clear();
+      attach();
     }
 
     /**
-     * Find the nearest object to the given coordinate
+     * Get the world's bounding box
+     * @param x0 receives the left coordinate of the world
+     * @param y0 receives the lower coordinate of the world
+     * @param x1 receives the right coordinate of the world
+     * @param y1 receives the upper coordinate of the world
+     */
+    void bounds(float &x0, float &y0, float &x1, float &y1) const {
+      x0 = world_x0;
+      y0 = world_y0;
+      x1 = world_x1;
+      y1 = world_y1;
+    }
+
+    /**
+     * @return the number of objects in the partition
+     */
+    int size() const {
+      return view_objects? view_size: objects.size();
+    }
+
+    /**
+     * Find the nearest object to the given coordinate. The search visits rings of cells around the cell
+     * containing the coordinate, and stops as soon as no cell of the next ring can be closer than the nearest
+     * object found so far, so the result is exact within the search levels. Cells of a ring that are farther
+     * than the nearest object are skipped.
      * @param x the x coordinate
      * @param y the y coordinate
-     * @param max_dist the distance threshold, after that, the search will give up
-     * @return pointer to the closest object or null if none is found
+     * @return pointer to the closest object or null if none is found, its distance, and the number of objects
+     *   searched
      */  
     std::tuple<T*, double, int> findNearest(double x, double y) const {
-      int cx0 = (x - world_x0) / cell_size;
-      int cy0 = (y - world_y0) / cell_size;
-      int cx1 = cx0 + 1;
-      int cy1 = cy0 + 1;
-      int level = 0;
+      int cx = std::floor((x - world_x0) / cell_size);
+      int cy = std::floor((y - world_y0) / cell_size);
       int searched = 0;
-      T* found = NULL;
-      double min_dist = 1.E20; // big enough
-      while(!found && level++ < search_levels) {
-        cx0 = std::max(0, cx0);
-        cy0 = std::max(0, cy0);
-        cx1 = std::min(dim_x, cx1);
-        cy1 = std::min(dim_y, cy1);
-        for (int j = cy0; j < cy1; j++) {
-          for (int i = cx0; i <cx1; i++) {
-            if (i > cx0 && j > cy0 && i < cx1 - 1 && j < cy1 - 1) { // in the previous level
-              continue;
+      int found = -1;
+      float min_dist = 1.E20; // big enough
+      for (int level = 0; level < search_levels; level++) {
+        if (level > 0) {
+          bool covers;
+          double margin = ringDistance(cx, cy, level, x, y, covers);
+          if (covers || (found >= 0 && margin > 0 && min_dist <= margin * margin)) {
+            break;
+          }
+        }
+        forEachRingCell(cx, cy, level, [&](int i, int j) {
+          if (found >= 0 && cellDistance2(i, j, x, y) >= min_dist) {
+            return;
+          }
+          int cell = cellIndex(i, j);
+          int start = cell_data[cell];
+          int count = cell_data[cell + 1] - start;
+          if (count == 0) {
+            return;
+          }
+          int k = DistanceKernels::nearest(&x_data[start], &y_data[start], count, x, y, min_dist);
+          if (k >= 0) {
+            found = start + k;
+          }
+          searched += count;
+        });
+      }
+      return std::make_tuple(found >= 0? object(found): NULL, found >= 0? sqrt(min_dist): -1, searched);
+    }
+
+    /**
+     * Find the nearest objects to a batch of coordinates. The queries are grouped by the cell containing
+     * them, and the queries of a group search the rings of cells around their cell together, so each cell is
+     * visited once per group, and its objects stay in cache while the queries scan them. Each query stops searching on its own
+     * like findNearest().
+     * @param x the x coordinates
+     * @param y the y coordinates
+     * @param n the number of coordinates
+     * @param index receives the index of the closest object of each coordinate, -1 if none is found, see
+     *   object(), pointX(), and pointY()
+     * @param distance receives the distance to the closest object of each coordinate, -1 if none is found
+     * @param searched if not NULL, receives the number of objects searched for each coordinate
+     */
+    void findNearestBatch(const double *x, const double *y, int n, int *index, double *distance,
+                          int *searched = NULL) const {
+      static thread_local BatchScratch scratch;
+      scratch.reserve(n);
+      uint32_t *cells = scratch.cell.data();
+      int *order = scratch.order.data();
+      int *sorted = scratch.sorted.data();
+      float *min_dist = scratch.min_dist.data();
+      int *count = scratch.count.data();
+      int *active = scratch.active.data();
+      int *scan = scratch.scan.data();
+
+      // Group the queries by cell with a least significant digit radix sort of their cells, which is stable
+      // and only takes as many passes as the cell indices have digits. Queries outside of the world share the
+      // key past the last cell, and get their own group each.
+      const uint32_t outside = uint32_t(dim_x) * dim_y;
+      for (int q = 0; q < n; q++) {
+        int cx = std::floor((x[q] - world_x0) / cell_size);
+        int cy = std::floor((y[q] - world_y0) / cell_size);
+        cells[q] = cx >= 0 && cy >= 0 && cx < dim_x && cy < dim_y? cellIndex(cx, cy): outside;
+        order[q] = q;
+        index[q] = -1;
+        min_dist[q] = 1.E20; // big enough
+        count[q] = 0;
+      }
+      for (int shift = 0; (uint64_t(outside) >> shift) > 0; shift += RADIX_BITS) {
+        int bucket[(1 << RADIX_BITS) + 1] = {0};
+        for (int a = 0; a < n; a++) {
+          bucket[((cells[order[a]] >> shift) & ((1 << RADIX_BITS) - 1)) + 1]++;
+        }
+        for (int b = 1; b <= (1 << RADIX_BITS); b++) {
+          bucket[b] += bucket[b - 1];
+        }
+        for (int a = 0; a < n; a++) {
+          int q = order[a];
+          sorted[bucket[(cells[q] >> shift) & ((1 << RADIX_BITS) - 1)]++] = q;
+        }
+        std::swap(order, sorted);
+      }
+
+      for (int g0 = 0, g1 = 0; g0 < n; g0 = g1) {
+        uint32_t cell = cells[order[g0]];
+        int active_count = 0;
+        for (g1 = g0; g1 < n && cells[order[g1]] == cell && (g1 == g0 || cell != outside); g1++) {
+          active[active_count++] = order[g1];
+        }
+        int q0 = active[0];
+        int cx = std::floor((x[q0] - world_x0) / cell_size);
+        int cy = std::floor((y[q0] - world_y0) / cell_size);
+        for (int level = 0; level < search_levels && active_count > 0; level++) {
+          if (level > 0) {
+            // Retire the queries whose nearest object is closer than any cell of this ring
+            bool covers = false;
+            for (int a = 0; a < active_count; a++) {
+              int q = active[a];
+              double margin = ringDistance(cx, cy, level, x[q], y[q], covers);
+              if (index[q] >= 0 && margin > 0 && min_dist[q] <= margin * margin) {
+                active[a--] = active[--active_count];
+              }
+            }
+            if (covers) {
+              break;
+            }
+          }
+          forEachRingCell(cx, cy, level, [&](int i, int j) {
+            int cell = cellIndex(i, j);
+            if (cell_data[cell] == cell_data[cell + 1]) {
+              return;
+            }
+            int scan_count = 0;
+            for (int a = 0; a < active_count; a++) {
+              int q = active[a];
+              if (index[q] < 0 || cellDistance2(i, j, x[q], y[q]) < min_dist[q]) {
+                scan[scan_count++] = q;
+              }
             }
-            std::vector<T*> *objects = cells[cellIndex(i, j)];
-            if (objects) {
-              for (typename std::vector<T*>::iterator obj = objects->begin(); obj != objects->end(); obj++) {
-                searched++;
-                double dis = dist(x, y, (*obj)->x(), (*obj)->y());
-                if (min_dist > dis) {
-                  min_dist = dis;
-                  found = *obj;
-                }
+            int start = cell_data[cell];
+            int points = cell_data[cell + 1] - start;
+            for (int a = 0; a < scan_count; a++) {
+              int q = scan[a];
+              int k = DistanceKernels::nearest(&x_data[start], &y_data[start], points, x[q], y[q], min_dist[q]);
+              if (k >= 0) {
+                index[q] = start + k;
               }
+              count[q] += points;
             }
+          });
+        }
+      }
+      for (int q = 0; q < n; q++) {
+        distance[q] = index[q] >= 0? sqrt(min_dist[q]): -1;
+        if (searched) {
+          searched[q] = count[q];
+        }
+      }
+    }
+
+    /**
+     * Find the k nearest objects to the given coordinate, within the search levels. The closest objects found
+     * so far are kept in a bounded max-heap in the caller's buffers, and the search stops as soon as no cell
+     * of the next ring can be closer than the farthest of them.
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @param k the number of objects to find
+     * @param index receives the indices of the objects, nearest first, see object(), pointX(), and pointY(),
+     *   at least k long
+     * @param distance receives the distances of the objects, at least k long
+     * @return the number of objects found, at most k
+     */
+    int findKNearest(double x, double y, int k, int *index, double *distance) const {
+      int cx = std::floor((x - world_x0) / cell_size);
+      int cy = std::floor((y - world_y0) / cell_size);
+      int found = 0;
+      for (int level = 0; level < search_levels && k > 0; level++) {
+        if (level > 0) {
+          bool covers;
+          double margin = ringDistance(cx, cy, level, x, y, covers);
+          if (covers || (found == k && margin > 0 && distance[0] <= margin * margin)) {
+            break;
           }
         }
+        forEachRingCell(cx, cy, level, [&](int i, int j) {
+          if (found == k && cellDistance2(i, j, x, y) >= distance[0]) {
+            return;
+          }
+          int cell = cellIndex(i, j);
+          for (int p = cell_data[cell]; p < cell_data[cell + 1]; p++) {
+            double dis = dist2(x, y, x_data[p], y_data[p]);
+            if (found < k) {
+              index[found] = p;
+              distance[found] = dis;
+              siftUp(index, distance, found++);
+            } else if (dis < distance[0]) {
+              index[0] = p;
+              distance[0] = dis;
+              siftDown(index, distance, 0, k);
+            }
+          }
+        });
+      }
+      // Sort the heap in place, nearest first
+      for (int end = found - 1; end > 0; end--) {
+        std::swap(index[0], index[end]);
+        std::swap(distance[0], distance[end]);
+        siftDown(index, distance, 0, end);
+      }
+      for (int i = 0; i < found; i++) {
+        distance[i] = sqrt(distance[i]);
+      }
+      return found;
+    }
 
-        --cx0;
-        --cy0;
-        ++cx1;
-        ++cy1;
+    /**
+     * Find the objects within a distance of the given coordinate, in no particular order
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @param radius the distance
+     * @param index receives the indices of the objects, see object(), pointX(), and pointY()
+     * @param distance receives the distances of the objects
+     * @param capacity the length of index and distance, objects past it are counted but not written
+     * @return the number of objects within the distance, which may be more than capacity
+     */
+    int findWithin(double x, double y, double radius, int *index, double *distance, int capacity) const {
+      double radius2 = radius * radius;
+      int cx0 = std::max(0, int(std::floor((x - radius - world_x0) / cell_size)));
+      int cy0 = std::max(0, int(std::floor((y - radius - world_y0) / cell_size)));
+      int cx1 = std::min(dim_x - 1, int(std::floor((x + radius - world_x0) / cell_size)));
+      int cy1 = std::min(dim_y - 1, int(std::floor((y + radius - world_y0) / cell_size)));
+      int found = 0;
+      for (int j = cy0; j <= cy1; j++) {
+        for (int i = cx0; i <= cx1; i++) {
+          if (cellDistance2(i, j, x, y) > radius2) {
+            continue;
+          }
+          int cell = cellIndex(i, j);
+          for (int p = cell_data[cell]; p < cell_data[cell + 1]; p++) {
+            double dis = dist2(x, y, x_data[p], y_data[p]);
+            if (dis <= radius2) {
+              if (found < capacity) {
+                index[found] = p;
+                distance[found] = sqrt(dis);
+              }
+              found++;
+            }
+          }
+        }
       }
-      return std::make_tuple(found, found? sqrt(min_dist): -1, searched);
+      return found;
+    }
+
+    /**
+     * Get an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    T *object(int index) const {
+      return view_objects? view_objects + index: objects[index];
+    }
+
+    /**
+     * Get the x coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointX(int index) const {
+      return x_data[index];
+    }
+
+    /**
+     * Get the y coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointY(int index) const {
+      return y_data[index];
     }
 
     /** Add a point object. A point object has x and y coordinate, and provides accessor x() and y().
+     * The object is inserted after the other objects of its cell, use addPointObjects() to add many objects.
      * @param object pointer to the object
      */ 
     void addPointObject(T *object) {
-      int idx_x = (object->x() - world_x0) / cell_size;
-      int idx_y = (object->y() - world_y0) / cell_size;
-      int index = cellIndex(idx_x, idx_y);
-      if (!cells[index]) {
-        cells[index] = new std::vector<T*>();
+      assert(!view_objects);
+      int cell = cellOf(object->x(), object->y());
+      int at = cell_start[cell + 1];
+      point_x.insert(point_x.begin() + at, object->x());
+      point_y.insert(point_y.begin() + at, object->y());
+      objects.insert(objects.begin() + at, object);
+      for (size_t i = cell + 1; i < cell_start.size(); i++) {
+        cell_start[i]++;
       }
-      cells[index]->push_back(object);
+      attach();
     }
 
     /** Add a point objects. A point object has x and y coordinate, and provides accessor x() and y().
-     * @param object pointer to the object
+     * The objects are merged with the ones already added with a counting sort by cell.
+     * @param objects the objects
      */ 
     void addPointObjects(std::vector<T> &objects) {
-      for (int i = 0; i < objects.size(); i++) {
-        addPointObject(&objects[i]);
+      std::vector<T*> pointers(objects.size());
+      for (size_t i = 0; i < objects.size(); i++) {
+        pointers[i] = &objects[i];
+      }
+      addPointObjects(pointers);
+    }
+
+    /** Add a point objects. A point object has x and y coordinate, and provides accessor x() and y().
+     * The objects are merged with the ones already added with a counting sort by cell.
+     * @param objects pointers to the objects
+     */ 
+    void addPointObjects(const std::vector<T*> &objects) {
+      assert(!view_objects);
+      int cells = dim_x * dim_y;
+      int added = objects.size();
+      int total = this->objects.size() + added;
+      std::vector<int> object_cell(added);
+      std::vector<int> start(cells + 1, 0);
+      for (int i = 0; i < cells; i++) {
+        start[i + 1] = cell_start[i + 1] - cell_start[i];
+      }
+      for (int i = 0; i < added; i++) {
+        object_cell[i] = cellOf(objects[i]->x(), objects[i]->y());
+        start[object_cell[i] + 1]++;
       }
+      for (int i = 0; i < cells; i++) {
+        start[i + 1] += start[i];
+      }
+      // Place the existing points first in their cells, then the new ones
+      std::vector<float> xs(total);
+      std::vector<float> ys(total);
+      std::vector<T*> objs(total);
+      std::vector<int> next(start.begin(), start.end() - 1);
+      for (int i = 0; i < cells; i++) {
+        for (int k = cell_start[i]; k < cell_start[i + 1]; k++) {
+          int at = next[i]++;
+          xs[at] = point_x[k];
+          ys[at] = point_y[k];
+          objs[at] = this->objects[k];
+        }
+      }
+      for (int i = 0; i < added; i++) {
+        int at = next[object_cell[i]]++;
+        xs[at] = objects[i]->x();
+        ys[at] = objects[i]->y();
+        objs[at] = objects[i];
+      }
+      cell_start.swap(start);
+      point_x.swap(xs);
+      point_y.swap(ys);
+      this->objects.swap(objs);
+      attach();
+    }
+
+    /**
+     * Make the partition a copy of the cells of another partition that overlap a rectangle, reusing the
+     * storage of its arrays. The partition keeps the other's cells and search distance, so a search whose
+     * window of cells lies in the rectangle finds the same object in both.
+     * @param other the partition to copy
+     * @param x0 the left coordinate of the rectangle
+     * @param y0 the lower coordinate of the rectangle
+     * @param x1 the right coordinate of the rectangle
+     * @param y1 the upper coordinate of the rectangle
+     */
+    void copyRegion(const Partition2D &other, double x0, double y0, double x1, double y1) {
+      assert(!view_objects && &other != this);
+      int cx0 = std::min(other.dim_x - 1, std::max(0, int(std::floor((x0 - other.world_x0) / other.cell_size))));
+      int cy0 = std::min(other.dim_y - 1, std::max(0, int(std::floor((y0 - other.world_y0) / other.cell_size))));
+      int cx1 = std::max(cx0, std::min(other.dim_x - 1, int(std::floor((x1 - other.world_x0) / other.cell_size))));
+      int cy1 = std::max(cy0, std::min(other.dim_y - 1, int(std::floor((y1 - other.world_y0) / other.cell_size))));
+      cell_size = other.cell_size;
+      search_levels = other.search_levels;
+      dim_x = cx1 - cx0 + 1;
+      dim_y = cy1 - cy0 + 1;
+      world_x0 = other.world_x0 + cx0 * cell_size;
+      world_y0 = other.world_y0 + cy0 * cell_size;
+      world_x1 = std::min(other.world_x1, other.world_x0 + (cx1 + 1) * cell_size);
+      world_y1 = std::min(other.world_y1, other.world_y0 + (cy1 + 1) * cell_size);
+
+      // The cells of a row are contiguous in the other partition's arrays
+      cell_start.resize(dim_x * dim_y + 1);
+      point_x.clear();
+      point_y.clear();
+      objects.clear();
+      for (int j = 0; j < dim_y; j++) {
+        const int *starts = other.cell_data + other.cellIndex(cx0, cy0 + j);
+        int begin = starts[0];
+        int end = starts[dim_x];
+        for (int i = 0; i < dim_x; i++) {
+          cell_start[cellIndex(i, j)] = point_x.size() + starts[i] - begin;
+        }
+        point_x.insert(point_x.end(), other.x_data + begin, other.x_data + end);
+        point_y.insert(point_y.end(), other.y_data + begin, other.y_data + end);
+        for (int k = begin; k < end; k++) {
+          objects.push_back(other.object(k));
+        }
+      }
+      cell_start[dim_x * dim_y] = point_x.size();
+      attach();
+    }
+
+    /**
+     * @return the number of cells
+     */
+    int cellCount() const {
+      return dim_x * dim_y;
+    }
+
+    /**
+     * @return the start of each cell's objects in the arrays sorted by cell, cellCount() + 1 long, the last
+     *   one is size()
+     */
+    const int *cellStarts() const {
+      return cell_data;
+    }
+
+    /**
+     * @return the width and height of cells
+     */
+    float cellSize() const {
+      return cell_size;
+    }
+
+    /**
+     * @return the maximum distance searched
+     */
+    float maxDistance() const {
+      return search_levels * cell_size;
     }
 };
 
-#endif
\ No newline at end of file
+#endif
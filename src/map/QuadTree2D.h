@@ -0,0 +1,346 @@
+#ifndef _MAP_QUADTREE2D_H_
+#define _MAP_QUADTREE2D_H_
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include "../utils/helper_functions.h"
+#include "DistanceKernels.h"
+
+/**
+ * A static adaptive quadtree of point objects, an alternative to Partition2D for maps with uneven point
+ * density, with the same query interface. A quadrant is only split while it holds more than a bucket of
+ * points, so dense areas get small leaves and sparse areas large ones, and a query scans about the same number
+ * of points anywhere on the map. The points are sorted by the Morton code of their location, which makes the
+ * points of any quadrant contiguous, and the nodes are stored in a flat array, the children of a node next to
+ * each other in Morton order. Only non-empty quadrants get a node, and a node's box is the bounding box of its
+ * points rather than its quadrant, which prunes more of the search.
+ */
+template<typename T> class QuadTree2D {
+  private:
+    // The number of bits of each coordinate in the Morton codes, which bounds the depth of the tree
+    static const int MORTON_BITS = 16;
+
+    // The maximum number of nodes to visit later in a search: up to 3 siblings per level
+    static const int MAX_STACK = 4 * (MORTON_BITS + 1);
+
+    /**
+     * A node of the tree
+     */
+    struct Node {
+      // The bounding box of the node's points
+      float x0;
+      float y0;
+      float x1;
+      float y1;
+
+      // The node's points
+      int begin;
+      int end;
+
+      // The first child and the number of children, the children are contiguous, a leaf has none
+      int child;
+      int children;
+    };
+
+    // The points sorted in Morton order
+    std::vector<float> point_x;
+    std::vector<float> point_y;
+    std::vector<T*> objects;
+
+    // The nodes, the root first
+    std::vector<Node> nodes;
+
+    // The maximum number of points of a leaf
+    int bucket_size = 8;
+
+    // The maximum distance to search
+    float max_dist = 1.E10;
+
+    // The depth of the tree
+    int tree_depth = 0;
+
+    /**
+     * Spread the bits of a coordinate to the even bits of a Morton code
+     */
+    static uint32_t spreadBits(uint32_t v) {
+      v = (v | (v << 8)) & 0x00FF00FF;
+      v = (v | (v << 4)) & 0x0F0F0F0F;
+      v = (v | (v << 2)) & 0x33333333;
+      v = (v | (v << 1)) & 0x55555555;
+      return v;
+    }
+
+    /**
+     * Get the squared distance from a location to a node's bounding box, 0 inside of it
+     */
+    static float boxDistance2(const Node &node, float x, float y) {
+      float dx = std::max(std::max(node.x0 - x, x - node.x1), 0.f);
+      float dy = std::max(std::max(node.y0 - y, y - node.y1), 0.f);
+      return dx * dx + dy * dy;
+    }
+
+    /**
+     * Build the subtree of a node
+     * @param n the node, its range of points is set
+     * @param codes the points' Morton codes
+     * @param level the level of the node, the root's is 0
+     */
+    void build(int n, const std::vector<uint32_t> &codes, int level) {
+      int begin = nodes[n].begin;
+      int end = nodes[n].end;
+      float x0 = 1.E20, y0 = 1.E20, x1 = -1.E20, y1 = -1.E20;
+      for (int i = begin; i < end; i++) {
+        x0 = std::min(x0, point_x[i]);
+        x1 = std::max(x1, point_x[i]);
+        y0 = std::min(y0, point_y[i]);
+        y1 = std::max(y1, point_y[i]);
+      }
+      nodes[n].x0 = x0;
+      nodes[n].y0 = y0;
+      nodes[n].x1 = x1;
+      nodes[n].y1 = y1;
+      nodes[n].child = -1;
+      nodes[n].children = 0;
+      tree_depth = std::max(tree_depth, level);
+      if (end - begin <= bucket_size || level == MORTON_BITS) {
+        return;
+      }
+      // The quadrant of a point is given by two bits of its code, and the points of a quadrant are contiguous
+      int shift = 2 * (MORTON_BITS - 1 - level);
+      int first = nodes.size();
+      int quadrant_begin = begin;
+      for (uint32_t quadrant = 0; quadrant < 4; quadrant++) {
+        int quadrant_end = std::partition_point(codes.begin() + quadrant_begin, codes.begin() + end,
+                                                [shift, quadrant](uint32_t code) {
+                                                  return ((code >> shift) & 3) <= quadrant;
+                                                }) - codes.begin();
+        if (quadrant_end > quadrant_begin) {
+          Node child;
+          child.begin = quadrant_begin;
+          child.end = quadrant_end;
+          nodes.push_back(child);
+        }
+        quadrant_begin = quadrant_end;
+      }
+      nodes[n].child = first;
+      nodes[n].children = nodes.size() - first;
+      for (int c = first; c < first + nodes[n].children; c++) {
+        build(c, codes, level + 1);
+      }
+    }
+
+    /**
+     * Find the nearest point in the tree
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @param min_dist the squared distance to beat, updated to the nearest point's squared distance
+     * @param searched receives the number of points searched
+     * @return the index of the nearest point, or -1 if no point is closer than min_dist
+     */
+    int nearest(float x, float y, float &min_dist, int &searched) const {
+      // Nodes still to visit, with the squared distance of their bounding box
+      int stack_node[MAX_STACK];
+      float stack_dist[MAX_STACK];
+      int top = 0;
+      int found = -1;
+      searched = 0;
+      if (nodes.empty()) {
+        return found;
+      }
+      stack_node[top] = 0;
+      stack_dist[top++] = boxDistance2(nodes[0], x, y);
+      while (top > 0) {
+        top--;
+        if (stack_dist[top] >= min_dist) {
+          continue;
+        }
+        const Node &node = nodes[stack_node[top]];
+        if (node.children == 0) {
+          int k = DistanceKernels::nearest(&point_x[node.begin], &point_y[node.begin], node.end - node.begin,
+                                           x, y, min_dist);
+          if (k >= 0) {
+            found = node.begin + k;
+          }
+          searched += node.end - node.begin;
+          continue;
+        }
+        // Push the children farthest first, so that the nearest one is visited next
+        int order[4];
+        float dist2[4];
+        for (int c = 0; c < node.children; c++) {
+          dist2[c] = boxDistance2(nodes[node.child + c], x, y);
+          int i = c;
+          for (; i > 0 && dist2[order[i - 1]] < dist2[c]; i--) {
+            order[i] = order[i - 1];
+          }
+          order[i] = c;
+        }
+        for (int c = 0; c < node.children; c++) {
+          if (dist2[order[c]] < min_dist) {
+            stack_node[top] = node.child + order[c];
+            stack_dist[top++] = dist2[order[c]];
+          }
+        }
+      }
+      return found;
+    }
+
+  public:
+    QuadTree2D() {}
+
+    /**
+     * Initialize the tree
+     * @param max_dist the maximum distance to search
+     * @param bucket_size the maximum number of points of a leaf
+     */
+    void initialize(float max_dist, int bucket_size = 8) {
+      this->max_dist = max_dist;
+      this->bucket_size = std::max(1, bucket_size);
+      clear();
+    }
+
+    /**
+     * Clear the tree
+     */
+    void clear() {
+      point_x.clear();
+      point_y.clear();
+      objects.clear();
+      nodes.clear();
+      tree_depth = 0;
+    }
+
+    /**
+     * @return the number of objects in the tree
+     */
+    int size() const {
+      return objects.size();
+    }
+
+    /**
+     * @return the number of nodes of the tree
+     */
+    int nodeCount() const {
+      return nodes.size();
+    }
+
+    /**
+     * @return the depth of the tree, 0 for a single leaf
+     */
+    int depth() const {
+      return tree_depth;
+    }
+
+    /**
+     * Find the nearest object to the given coordinate within the maximum distance
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @return pointer to the closest object or null if none is found, its distance, and the number of objects
+     *   searched
+     */
+    std::tuple<T*, double, int> findNearest(double x, double y) const {
+      float min_dist = max_dist * max_dist;
+      int searched;
+      int found = nearest(x, y, min_dist, searched);
+      return std::make_tuple(found >= 0? objects[found]: NULL, found >= 0? sqrt(min_dist): -1, searched);
+    }
+
+    /**
+     * Find the nearest objects to a batch of coordinates within the maximum distance. Nearby coordinates
+     * visit the same nodes, which stay in cache from one query to the next.
+     * @param x the x coordinates
+     * @param y the y coordinates
+     * @param n the number of coordinates
+     * @param index receives the index of the closest object of each coordinate, -1 if none is found, see
+     *   object(), pointX(), and pointY()
+     * @param distance receives the distance to the closest object of each coordinate, -1 if none is found
+     * @param searched if not NULL, receives the number of objects searched for each coordinate
+     */
+    void findNearestBatch(const double *x, const double *y, int n, int *index, double *distance,
+                          int *searched = NULL) const {
+      for (int q = 0; q < n; q++) {
+        float min_dist = max_dist * max_dist;
+        int count;
+        index[q] = nearest(x[q], y[q], min_dist, count);
+        distance[q] = index[q] >= 0? sqrt(min_dist): -1;
+        if (searched) {
+          searched[q] = count;
+        }
+      }
+    }
+
+    /**
+     * Get an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    T *object(int index) const {
+      return objects[index];
+    }
+
+    /**
+     * Get the x coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointX(int index) const {
+      return point_x[index];
+    }
+
+    /**
+     * Get the y coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointY(int index) const {
+      return point_y[index];
+    }
+
+    /** Add point objects, and rebuild the tree. A point object has x and y coordinate, and provides accessor
+     * x() and y().
+     * @param objects the objects
+     */
+    void addPointObjects(std::vector<T> &objects) {
+      std::vector<T*> all(this->objects);
+      for (size_t i = 0; i < objects.size(); i++) {
+        all.push_back(&objects[i]);
+      }
+      clear();
+      int n = all.size();
+      if (n == 0) {
+        return;
+      }
+      // Quantize the locations over the bounding square of the points
+      float x0 = 1.E20, y0 = 1.E20, x1 = -1.E20, y1 = -1.E20;
+      for (int i = 0; i < n; i++) {
+        x0 = std::min(x0, float(all[i]->x()));
+        x1 = std::max(x1, float(all[i]->x()));
+        y0 = std::min(y0, float(all[i]->y()));
+        y1 = std::max(y1, float(all[i]->y()));
+      }
+      float extent = std::max(std::max(x1 - x0, y1 - y0), 1.E-6f);
+      const uint32_t cells = 1 << MORTON_BITS;
+      std::vector<std::pair<uint32_t, int>> order(all.size());
+      for (int i = 0; i < n; i++) {
+        uint32_t qx = std::min<uint32_t>((all[i]->x() - x0) / extent * cells, cells - 1);
+        uint32_t qy = std::min<uint32_t>((all[i]->y() - y0) / extent * cells, cells - 1);
+        order[i] = std::make_pair(spreadBits(qx) | (spreadBits(qy) << 1), i);
+      }
+      std::sort(order.begin(), order.end());
+      std::vector<uint32_t> codes(all.size());
+      for (int i = 0; i < n; i++) {
+        codes[i] = order[i].first;
+        T *object = all[order[i].second];
+        point_x.push_back(object->x());
+        point_y.push_back(object->y());
+        this->objects.push_back(object);
+      }
+      Node root;
+      root.begin = 0;
+      root.end = all.size();
+      nodes.push_back(root);
+      build(0, codes, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,360 @@
+#ifndef _MAP_SPARSEGRID2D_H_
+#define _MAP_SPARSEGRID2D_H_
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include "../utils/helper_functions.h"
+#include "DistanceKernels.h"
+
+/**
+ * A uniform grid of point objects like Partition2D, for very large worlds where most cells are empty, such as
+ * landmarks along roads across a continent. Only the cells holding objects are stored, in an open addressing
+ * hash table keyed on the cells' coordinates, so the memory grows with the number of objects rather than with
+ * the area of the world. The objects are sorted by cell, and a table entry gives the range of its cell's
+ * objects. The queries have the same semantics as Partition2D's.
+ */
+template<typename T> class SparseGrid2D {
+  private:
+    // The maximum fraction of the table's slots in use
+    static constexpr double MAX_LOAD = 0.5;
+
+    /**
+     * A slot of the hash table. Every key is a valid cell, so an empty slot is marked by an empty range of
+     * objects instead, a cell in the table holds at least one.
+     */
+    struct Slot {
+      // The cell's coordinates, see key()
+      uint64_t key;
+
+      // The cell's objects
+      int begin;
+      int end;
+
+      bool empty() const {
+        return begin == end;
+      }
+    };
+
+    // The width and height of cells
+    float cell_size = 5;
+
+    // The number of rings of cells to search
+    int search_levels = 10;
+
+    // The range of the coordinates of the cells holding objects
+    int cell_x0 = 0;
+    int cell_y0 = 0;
+    int cell_x1 = -1;
+    int cell_y1 = -1;
+
+    // The objects sorted by cell
+    std::vector<float> point_x;
+    std::vector<float> point_y;
+    std::vector<T*> objects;
+
+    // The hash table, its size is a power of 2
+    std::vector<Slot> table;
+
+    // The number of bits of the table's size
+    int table_bits = 0;
+
+    // The number of cells holding objects
+    int cells = 0;
+
+    /**
+     * Get the key of a cell
+     */
+    static uint64_t key(int i, int j) {
+      return (uint64_t(uint32_t(i)) << 32) | uint32_t(j);
+    }
+
+    /**
+     * Get the first slot to probe for a key, Fibonacci hashing spreads neighboring cells over the table
+     */
+    int hash(uint64_t key) const {
+      return (key * 0x9E3779B97F4A7C15ull) >> (64 - table_bits);
+    }
+
+    /**
+     * Find a cell's slot
+     * @return the slot, or NULL if the cell holds no object
+     */
+    const Slot *find(int i, int j) const {
+      if (table.empty()) {
+        return NULL;
+      }
+      uint64_t k = key(i, j);
+      int mask = table.size() - 1;
+      for (int s = hash(k);; s = (s + 1) & mask) {
+        if (table[s].empty()) {
+          return NULL;
+        } else if (table[s].key == k) {
+          return &table[s];
+        }
+      }
+    }
+
+    /**
+     * Get the squared distance from a point to the closest point of a cell
+     */
+    double cellDistance2(int i, int j, double x, double y) const {
+      double left = double(i) * cell_size;
+      double bottom = double(j) * cell_size;
+      double dx = std::max(0., std::max(left - x, x - (left + cell_size)));
+      double dy = std::max(0., std::max(bottom - y, y - (bottom + cell_size)));
+      return dx * dx + dy * dy;
+    }
+
+    /**
+     * Call a function with the coordinates of each cell of a ring within the range of the cells holding
+     * objects
+     * @param cx the x coordinate of the ring's center cell
+     * @param cy the y coordinate of the ring's center cell
+     * @param level the level of the ring, 0 is the center cell itself
+     * @param f the function, called with the x and y coordinate of the cell
+     */
+    template<typename F> void forEachRingCell(int cx, int cy, int level, F f) const {
+      int x0 = std::max(cell_x0, cx - level);
+      int x1 = std::min(cell_x1, cx + level);
+      int y0 = std::max(cell_y0, cy - level);
+      int y1 = std::min(cell_y1, cy + level);
+      for (int j = y0; j <= y1; j++) {
+        if (j == cy - level || j == cy + level) {
+          for (int i = x0; i <= x1; i++) {
+            f(i, j);
+          }
+        } else { // inner rows only have the ring's two side cells
+          if (cx - level >= x0 && cx - level <= x1) {
+            f(cx - level, j);
+          }
+          if (level > 0 && cx + level >= x0 && cx + level <= x1) {
+            f(cx + level, j);
+          }
+        }
+      }
+    }
+
+    /**
+     * Find the nearest point within the search levels
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @param min_dist receives the squared distance of the nearest point
+     * @param searched receives the number of points searched
+     * @return the index of the nearest point, or -1 if none is found
+     */
+    int nearest(double x, double y, float &min_dist, int &searched) const {
+      int cx = std::floor(x / cell_size);
+      int cy = std::floor(y / cell_size);
+      int found = -1;
+      searched = 0;
+      min_dist = 1.E20; // big enough
+      for (int level = 0; level < search_levels; level++) {
+        if (level > 0) {
+          // Stop when the rings below the level cover all the cells holding objects, or when no cell of the
+          // ring can be closer than the nearest point found so far
+          if (cx - level + 1 <= cell_x0 && cy - level + 1 <= cell_y0 &&
+              cx + level - 1 >= cell_x1 && cy + level - 1 >= cell_y1) {
+            break;
+          }
+          double margin = std::min(std::min(x - double(cx - level + 1) * cell_size,
+                                            double(cx + level) * cell_size - x),
+                                   std::min(y - double(cy - level + 1) * cell_size,
+                                            double(cy + level) * cell_size - y));
+          if (found >= 0 && margin > 0 && min_dist <= margin * margin) {
+            break;
+          }
+        }
+        forEachRingCell(cx, cy, level, [&](int i, int j) {
+          if (found >= 0 && cellDistance2(i, j, x, y) >= min_dist) {
+            return;
+          }
+          const Slot *slot = find(i, j);
+          if (!slot) {
+            return;
+          }
+          int k = DistanceKernels::nearest(&point_x[slot->begin], &point_y[slot->begin],
+                                           slot->end - slot->begin, x, y, min_dist);
+          if (k >= 0) {
+            found = slot->begin + k;
+          }
+          searched += slot->end - slot->begin;
+        });
+      }
+      return found;
+    }
+
+  public:
+    SparseGrid2D() {}
+
+    /**
+     * Initialize the grid, the world is unbounded
+     * @param cell_size the width and height of cells
+     * @param max_dist the maximum distance to search
+     */
+    void initialize(float cell_size, float max_dist) {
+      this->cell_size = cell_size;
+      search_levels = max_dist / cell_size + 0.5;
+      clear();
+    }
+
+    /**
+     * Clear the grid
+     */
+    void clear() {
+      point_x.clear();
+      point_y.clear();
+      objects.clear();
+      table.clear();
+      table_bits = 0;
+      cells = 0;
+      cell_x0 = cell_y0 = 0;
+      cell_x1 = cell_y1 = -1;
+    }
+
+    /**
+     * @return the number of objects in the grid
+     */
+    int size() const {
+      return objects.size();
+    }
+
+    /**
+     * @return the number of cells holding objects
+     */
+    int cellCount() const {
+      return cells;
+    }
+
+    /**
+     * @return the memory used by the grid [bytes]
+     */
+    size_t memory() const {
+      return table.size() * sizeof(Slot) + objects.size() * (2 * sizeof(float) + sizeof(T*));
+    }
+
+    /**
+     * Find the nearest object to the given coordinate, exact within the search levels like
+     * Partition2D::findNearest()
+     * @param x the x coordinate
+     * @param y the y coordinate
+     * @return pointer to the closest object or null if none is found, its distance, and the number of objects
+     *   searched
+     */
+    std::tuple<T*, double, int> findNearest(double x, double y) const {
+      float min_dist;
+      int searched;
+      int found = nearest(x, y, min_dist, searched);
+      return std::make_tuple(found >= 0? objects[found]: NULL, found >= 0? sqrt(min_dist): -1, searched);
+    }
+
+    /**
+     * Find the nearest objects to a batch of coordinates
+     * @param x the x coordinates
+     * @param y the y coordinates
+     * @param n the number of coordinates
+     * @param index receives the index of the closest object of each coordinate, -1 if none is found, see
+     *   object(), pointX(), and pointY()
+     * @param distance receives the distance to the closest object of each coordinate, -1 if none is found
+     * @param searched if not NULL, receives the number of objects searched for each coordinate
+     */
+    void findNearestBatch(const double *x, const double *y, int n, int *index, double *distance,
+                          int *searched = NULL) const {
+      for (int q = 0; q < n; q++) {
+        float min_dist;
+        int count;
+        index[q] = nearest(x[q], y[q], min_dist, count);
+        distance[q] = index[q] >= 0? sqrt(min_dist): -1;
+        if (searched) {
+          searched[q] = count;
+        }
+      }
+    }
+
+    /**
+     * Get an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    T *object(int index) const {
+      return objects[index];
+    }
+
+    /**
+     * Get the x coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointX(int index) const {
+      return point_x[index];
+    }
+
+    /**
+     * Get the y coordinate of an object found by findNearestBatch()
+     * @param index the index of the object
+     */
+    float pointY(int index) const {
+      return point_y[index];
+    }
+
+    /** Add point objects, and rebuild the grid. A point object has x and y coordinate, and provides accessor
+     * x() and y().
+     * @param objects the objects
+     */
+    void addPointObjects(std::vector<T> &objects) {
+      std::vector<T*> all(this->objects);
+      for (size_t i = 0; i < objects.size(); i++) {
+        all.push_back(&objects[i]);
+      }
+      clear();
+      int n = all.size();
+      if (n == 0) {
+        return;
+      }
+      // Sort the objects by cell
+      std::vector<std::pair<uint64_t, int>> order(n);
+      cell_x0 = cell_y0 = 0x7FFFFFFF;
+      cell_x1 = cell_y1 = -0x7FFFFFFF;
+      for (int i = 0; i < n; i++) {
+        int cx = std::floor(all[i]->x() / cell_size);
+        int cy = std::floor(all[i]->y() / cell_size);
+        cell_x0 = std::min(cell_x0, cx);
+        cell_y0 = std::min(cell_y0, cy);
+        cell_x1 = std::max(cell_x1, cx);
+        cell_y1 = std::max(cell_y1, cy);
+        order[i] = std::make_pair(key(cx, cy), i);
+      }
+      std::sort(order.begin(), order.end());
+      for (int i = 0; i < n; i++) {
+        T *object = all[order[i].second];
+        point_x.push_back(object->x());
+        point_y.push_back(object->y());
+        this->objects.push_back(object);
+        cells += i == 0 || order[i].first != order[i - 1].first;
+      }
+      // Insert the cells' ranges into a table large enough for the load limit
+      table_bits = 1;
+      while ((1 << table_bits) * MAX_LOAD < cells) {
+        table_bits++;
+      }
+      Slot empty = {0, 0, 0};
+      table.assign(1 << table_bits, empty);
+      int mask = table.size() - 1;
+      for (int begin = 0; begin < n;) {
+        int end = begin + 1;
+        while (end < n && order[end].first == order[begin].first) {
+          end++;
+        }
+        int s = hash(order[begin].first);
+        while (!table[s].empty()) {
+          s = (s + 1) & mask;
+        }
+        table[s].key = order[begin].first;
+        table[s].begin = begin;
+        table[s].end = end;
+        begin = end;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * TiledMap.cpp
+ *
+ * Tiled map storage with a least recently used cache and a prefetch thread.
+ */
+
+#include <math.h>
+#include <fstream>
+#include "TiledMap.h"
+#include "../utils/helper_functions.h"
+
+TiledMap::~TiledMap() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  request_condition.notify_all();
+  if (prefetcher.joinable()) {
+    prefetcher.join();
+  }
+}
+
+bool TiledMap::open(const std::string &directory, int capacity, float cell_size, float max_dist) {
+  std::ifstream index(indexFile(directory).c_str());
+  if (!(index >> tile_size) || tile_size <= 0) {
+    return false;
+  }
+  this->directory = directory;
+  this->capacity = std::max(1, capacity);
+  this->cell_size = cell_size;
+  this->max_dist = max_dist;
+  if (!prefetcher.joinable()) {
+    prefetcher = std::thread(&TiledMap::work, this);
+  }
+  return true;
+}
+
+std::string TiledMap::tileFile(const std::string &directory, int i, int j) {
+  return directory + "/" + std::to_string(i) + "_" + std::to_string(j) + ".txt";
+}
+
+std::string TiledMap::indexFile(const std::string &directory) {
+  return directory + "/tiles.txt";
+}
+
+std::shared_ptr<TiledMap::Tile> TiledMap::read(uint64_t key) const {
+  std::shared_ptr<Tile> tile(new Tile());
+  tile->key = key;
+  Map map;
+  if (read_map_data(tileFile(directory, int32_t(key >> 32), int32_t(key & 0xFFFFFFFF)), map)) {
+    tile->landmarks.swap(map.landmark_list);
+  }
+  return tile;
+}
+
+std::shared_ptr<TiledMap::Tile> TiledMap::get(uint64_t key) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cached.find(key);
+    if (it != cached.end()) {
+      cache.splice(cache.begin(), cache, it->second);
+      hit_count++;
+      return cache.front();
+    }
+  }
+  // Read the tile without holding the lock, the prefetch thread may be reading another one
+  std::shared_ptr<Tile> tile = read(key);
+  std::lock_guard<std::mutex> lock(mutex);
+  miss_count++;
+  auto it = cached.find(key);
+  if (it != cached.end()) { // prefetched in the meantime
+    cache.splice(cache.begin(), cache, it->second);
+    return cache.front();
+  }
+  insert(tile);
+  return tile;
+}
+
+void TiledMap::insert(const std::shared_ptr<Tile> &tile) {
+  cache.push_front(tile);
+  cached[tile->key] = cache.begin();
+  while (int(cache.size()) > capacity) {
+    cached.erase(cache.back()->key);
+    cache.pop_back();
+  }
+}
+
+void TiledMap::prefetch(int i0, int j0, int i1, int j1) {
+  bool added = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int j = j0; j <= j1; j++) {
+      for (int i = i0; i <= i1; i++) {
+        uint64_t k = key(i, j);
+        if (!cached.count(k) && requested.insert(k).second) {
+          requests.push_back(k);
+          added = true;
+        }
+      }
+    }
+  }
+  if (added) {
+    request_condition.notify_one();
+  }
+}
+
+void TiledMap::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    request_condition.wait(lock, [this] { return stopping || !requests.empty(); });
+    if (stopping) {
+      return;
+    }
+    uint64_t k = requests.front();
+    requests.pop_front();
+    if (!cached.count(k)) {
+      lock.unlock();
+      std::shared_ptr<Tile> tile = read(k);
+      lock.lock();
+      if (!cached.count(k)) {
+        insert(tile);
+        prefetch_count++;
+      }
+    }
+    requested.erase(k);
+  }
+}
+
+const Partition2D<TiledMap::Landmark> &TiledMap::partition(double x0, double y0, double x1, double y1) {
+  int i0 = floor((x0 - max_dist) / tile_size);
+  int j0 = floor((y0 - max_dist) / tile_size);
+  int i1 = floor((x1 + max_dist) / tile_size);
+  int j1 = floor((y1 + max_dist) / tile_size);
+  std::vector<uint64_t> keys;
+  for (int j = j0; j <= j1; j++) {
+    for (int i = i0; i <= i1; i++) {
+      keys.push_back(key(i, j));
+    }
+  }
+  if (keys != active_keys) {
+    active.clear();
+    std::vector<Landmark*> landmarks;
+    for (size_t k = 0; k < keys.size(); k++) {
+      active.push_back(get(keys[k]));
+      for (auto &landmark : active.back()->landmarks) {
+        landmarks.push_back(&landmark);
+      }
+    }
+    active_keys.swap(keys);
+    grid.initialize(i0 * tile_size, j0 * tile_size, (i1 + 1) * tile_size, (j1 + 1) * tile_size, cell_size,
+                    max_dist);
+    grid.addPointObjects(landmarks);
+  }
+
+  // Prefetch the tiles a tile ahead of the box along its motion since the last frame, if the cache can hold
+  // them next to the tiles in use without evicting these
+  double cx = (x0 + x1) / 2;
+  double cy = (y0 + y1) / 2;
+  if (has_last && 2 * int(active_keys.size()) <= capacity) {
+    double dx = cx - last_x;
+    double dy = cy - last_y;
+    double moved = sqrt(dx * dx + dy * dy);
+    if (moved > 0) {
+      double ahead_x = dx / moved * tile_size;
+      double ahead_y = dy / moved * tile_size;
+      prefetch(floor((x0 - max_dist + ahead_x) / tile_size), floor((y0 - max_dist + ahead_y) / tile_size),
+               floor((x1 + max_dist + ahead_x) / tile_size), floor((y1 + max_dist + ahead_y) / tile_size));
+    }
+  }
+  last_x = cx;
+  last_y = cy;
+  has_last = true;
+  return grid;
+}
+
+void TiledMap::statistics(int &hits, int &misses, int &prefetched) {
+  std::lock_guard<std::mutex> lock(mutex);
+  hits = hit_count;
+  misses = miss_count;
+  prefetched = prefetch_count;
+}
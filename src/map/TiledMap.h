@@ -0,0 +1,167 @@
+#ifndef _MAP_TILEDMAP_H_
+#define _MAP_TILEDMAP_H_
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Map.h"
+#include "Partition2D.h"
+
+/**
+ * A map store for maps too large to load at once. The world is split into square tiles, each stored in its own
+ * file in the map's format, see split_map. Only the tiles around the particles are partitioned for the update,
+ * the tiles loaded stay in a least recently used cache of a bounded number of tiles, and a background thread
+ * loads the tiles ahead of the particles along their direction of travel before they are needed.
+ */
+class TiledMap {
+  public:
+    typedef Map::single_landmark_s Landmark;
+
+  private:
+    /**
+     * A tile and its landmarks
+     */
+    struct Tile {
+      uint64_t key;
+      std::vector<Landmark> landmarks;
+    };
+
+    typedef std::list<std::shared_ptr<Tile>> TileList;
+
+    // The directory of the tiles, and the width and height of a tile [m]
+    std::string directory;
+    double tile_size = 0;
+
+    // The maximum number of tiles in the cache
+    int capacity = 0;
+
+    // The cell size and search distance of the partition
+    float cell_size = 5;
+    float max_dist = 50;
+
+    // The cached tiles, the most recently used first, and their position in the list by key
+    TileList cache;
+    std::unordered_map<uint64_t, TileList::iterator> cached;
+
+    // Statistics
+    int hit_count = 0;
+    int miss_count = 0;
+    int prefetch_count = 0;
+
+    // The prefetch thread, and the keys of the tiles it is asked to load
+    std::thread prefetcher;
+    std::deque<uint64_t> requests;
+    std::set<uint64_t> requested;
+    bool stopping = false;
+
+    // Protects the cache, the statistics, and the requests
+    std::mutex mutex;
+    std::condition_variable request_condition;
+
+    // The tiles partitioned, they are kept alive by the partition even after they leave the cache
+    std::vector<std::shared_ptr<Tile>> active;
+    std::vector<uint64_t> active_keys;
+    Partition2D<Landmark> grid;
+
+    // The center of the particles' bounding box in the last frame
+    double last_x = 0;
+    double last_y = 0;
+    bool has_last = false;
+
+    /**
+     * Get the key of a tile
+     */
+    static uint64_t key(int i, int j) {
+      return (uint64_t(uint32_t(i)) << 32) | uint32_t(j);
+    }
+
+    /**
+     * Read a tile from its file, a missing file is an empty tile
+     * @param key the tile's key
+     */
+    std::shared_ptr<Tile> read(uint64_t key) const;
+
+    /**
+     * Get a tile from the cache, reading it on a miss
+     * @param key the tile's key
+     */
+    std::shared_ptr<Tile> get(uint64_t key);
+
+    /**
+     * Add a tile to the cache, and evict the least recently used tiles above the capacity. The mutex must be
+     * held.
+     * @param tile the tile
+     */
+    void insert(const std::shared_ptr<Tile> &tile);
+
+    /**
+     * Ask the prefetch thread to load the tiles of a range that are not cached yet
+     */
+    void prefetch(int i0, int j0, int i1, int j1);
+
+    /**
+     * The prefetch thread's loop
+     */
+    void work();
+
+  public:
+    TiledMap() {}
+
+    ~TiledMap();
+
+    /**
+     * Open a tiled map, and start the prefetch thread
+     * @param directory the directory written by split_map
+     * @param capacity the maximum number of tiles in the cache
+     * @param cell_size the width and height of the partition's cells
+     * @param max_dist the maximum distance to search
+     * @return false if the directory does not hold a tiled map
+     */
+    bool open(const std::string &directory, int capacity, float cell_size, float max_dist);
+
+    /**
+     * Get the name of a tile's file
+     * @param directory the map's directory
+     * @param i the x index of the tile
+     * @param j the y index of the tile
+     */
+    static std::string tileFile(const std::string &directory, int i, int j);
+
+    /**
+     * Get the name of the file describing a tiled map, its first line is the size of the tiles
+     * @param directory the map's directory
+     */
+    static std::string indexFile(const std::string &directory);
+
+    /**
+     * @return the width and height of a tile [m]
+     */
+    double tileSize() const {
+      return tile_size;
+    }
+
+    /**
+     * Get a partition of the landmarks of the tiles within the search distance of a bounding box. The
+     * partition is rebuilt when the tiles change, and the tiles ahead of the box's motion since the last
+     * call are prefetched.
+     * @param x0 the left coordinate of the box
+     * @param y0 the lower coordinate of the box
+     * @param x1 the right coordinate of the box
+     * @param y1 the upper coordinate of the box
+     */
+    const Partition2D<Landmark> &partition(double x0, double y0, double x1, double y1);
+
+    /**
+     * Get the numbers of tiles found in the cache, read on a miss, and prefetched so far
+     */
+    void statistics(int &hits, int &misses, int &prefetched);
+};
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * Converts a text map to a binary map file for MapFile, with its Partition2D built with the given cell size,
+ * or one chosen from the landmarks with Partition2D::autoConfigure(), and search distance.
+ *
+ * Usage: convert_map map_file binary_file [cell_size|auto [max_dist]]
+ */
+#include <stdio.h>
+#include <algorithm>
+#include <iostream>
+#include "../map/MapFile.h"
+#include "../utils/helper_functions.h"
+
+int main(int argc, char* argv[]) {
+  float cell_size = 5;
+  float max_dist = 50;
+  if (argc < 3 || argc > 5 ||
+      (argc > 3 && std::string(argv[3]) != "auto" && (sscanf(argv[3], "%f", &cell_size) != 1 || cell_size <= 0)) ||
+      (argc > 4 && (sscanf(argv[4], "%f", &max_dist) != 1 || max_dist <= 0))) {
+    std::cerr << "Usage: " << argv[0] << " map_file binary_file [cell_size|auto [max_dist]]" << std::endl;
+    exit(-1);
+  }
+  bool automatic = argc > 3 && std::string(argv[3]) == "auto";
+  Map map;
+  if (!read_map_data(argv[1], map) || map.landmark_list.empty()) {
+    std::cerr << "Could not open map file: " << argv[1] << std::endl;
+    exit(-1);
+  }
+
+  // The same world as the particle filter's, the bounding box of the landmarks with a margin of 1 m
+  float x0 = 1E20, y0 = 1E20, x1 = -1E20, y1 = -1E20;
+  for (auto it = map.landmark_list.begin(); it != map.landmark_list.end(); it++) {
+    x0 = std::min(x0, it->x());
+    x1 = std::max(x1, it->x());
+    y0 = std::min(y0, it->y());
+    y1 = std::max(y1, it->y());
+  }
+  Partition2D<Map::single_landmark_s> partition;
+  if (automatic) {
+    partition.autoConfigure(x0-1, y0-1, x1+1, y1+1, max_dist, map.landmark_list, 1000, 2);
+  } else {
+    partition.initialize(x0-1, y0-1, x1+1, y1+1, cell_size, max_dist);
+    partition.addPointObjects(map.landmark_list);
+  }
+  if (!MapFile::write(argv[2], partition)) {
+    std::cerr << "Could not write binary map file: " << argv[2] << std::endl;
+    exit(-1);
+  }
+  std::cout << partition.size() << " landmarks, cell size " << partition.cellSize() << " m, search distance "
+            << partition.maxDistance() << " m" << std::endl;
+  return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * Splits a map into square tiles for TiledMap, one file per non-empty tile in the map's format, plus an index
+ * file holding the size of the tiles.
+ *
+ * Usage: split_map map_file directory tile_size
+ */
+#include <stdio.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+#include "../map/TiledMap.h"
+#include "../utils/helper_functions.h"
+
+int main(int argc, char* argv[]) {
+  double tile_size;
+  if (argc != 4 || sscanf(argv[3], "%lf", &tile_size) != 1 || tile_size <= 0) {
+    std::cerr << "Usage: " << argv[0] << " map_file directory tile_size" << std::endl;
+    exit(-1);
+  }
+  Map map;
+  if (!read_map_data(argv[1], map)) {
+    std::cerr << "Could not open map file: " << argv[1] << std::endl;
+    exit(-1);
+  }
+  std::string directory = argv[2];
+  mkdir(directory.c_str(), 0755);
+
+  // Group the landmarks by tile
+  std::map<std::pair<int, int>, std::vector<Map::single_landmark_s*>> tiles;
+  for (auto it = map.landmark_list.begin(); it != map.landmark_list.end(); it++) {
+    int i = floor(it->x() / tile_size);
+    int j = floor(it->y() / tile_size);
+    tiles[std::make_pair(i, j)].push_back(&*it);
+  }
+
+  for (auto tile = tiles.begin(); tile != tiles.end(); tile++) {
+    std::string name = TiledMap::tileFile(directory, tile->first.first, tile->first.second);
+    std::ofstream out(name.c_str());
+    out << std::setprecision(9);
+    for (auto landmark : tile->second) {
+      out << landmark->x() << "\t" << landmark->y() << "\t" << landmark->id() << "\n";
+    }
+    if (!out) {
+      std::cerr << "Could not write tile: " << name << std::endl;
+      exit(-1);
+    }
+  }
+  std::ofstream index(TiledMap::indexFile(directory).c_str());
+  index << std::setprecision(17) << tile_size << std::endl;
+  if (!index) {
+    std::cerr << "Could not write tile index: " << TiledMap::indexFile(directory) << std::endl;
+    exit(-1);
+  }
+  std::cout << map.landmark_list.size() << " landmarks in " << tiles.size() << " tiles of " << tile_size << " m"
+            << std::endl;
+  return 0;
+}
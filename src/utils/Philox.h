@@ -0,0 +1,130 @@
+#ifndef _UTILS_PHILOX_H_
+#define _UTILS_PHILOX_H_
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * Philox4x32-10 counter-based random number generator (Salmon et al., "Parallel Random Numbers: As Easy as
+ * 1, 2, 3"). Random numbers are a pure function of a key and a 128-bit counter, so any thread can generate
+ * the numbers of any counter without sharing state, and the results do not depend on which thread does it.
+ * Instances with different keys produce independent streams.
+ */
+class Philox {
+  private:
+    uint32_t key[2];
+
+    static void round(uint32_t ctr[4], const uint32_t k[2]) {
+      uint64_t p0 = uint64_t(0xD2511F53) * ctr[0];
+      uint64_t p1 = uint64_t(0xCD9E8D57) * ctr[2];
+      uint32_t out0 = uint32_t(p1 >> 32) ^ ctr[1] ^ k[0];
+      uint32_t out2 = uint32_t(p0 >> 32) ^ ctr[3] ^ k[1];
+      ctr[0] = out0;
+      ctr[1] = uint32_t(p1);
+      ctr[2] = out2;
+      ctr[3] = uint32_t(p0);
+    }
+
+  public:
+    /**
+     * A sequential stream of the random words of consecutive counters (i, c1, c2, 0), i = 0, 1, ..., for use
+     * with the standard library distributions.
+     */
+    class Stream {
+      private:
+        const Philox &philox;
+        uint32_t c1;
+        uint32_t c2;
+        uint32_t counter = 0;
+        uint32_t words[4];
+        int used = 4;
+
+      public:
+        typedef uint32_t result_type;
+
+        static constexpr result_type min() {
+          return 0;
+        }
+
+        static constexpr result_type max() {
+          return 0xFFFFFFFF;
+        }
+
+        /**
+         * Create a stream
+         * @param philox the generator
+         * @param c1 the second word of the counters
+         * @param c2 the third word of the counters
+         */
+        Stream(const Philox &philox, uint32_t c1, uint32_t c2) : philox(philox), c1(c1), c2(c2) {}
+
+        result_type operator()() {
+          if (used == 4) {
+            philox.generate(counter++, c1, c2, 0, words);
+            used = 0;
+          }
+          return words[used++];
+        }
+    };
+
+    /**
+     * Create a generator
+     * @param seed the key of the generator
+     */
+    Philox(uint64_t seed = 0) {
+      key[0] = uint32_t(seed);
+      key[1] = uint32_t(seed >> 32);
+    }
+
+    /**
+     * Generate the 4 random words of a counter
+     * @param c0 the first word of the counter
+     * @param c1 the second word of the counter
+     * @param c2 the third word of the counter
+     * @param c3 the fourth word of the counter
+     * @param out receives the random words
+     */
+    void generate(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t out[4]) const {
+      uint32_t k[2] = {key[0], key[1]};
+      out[0] = c0;
+      out[1] = c1;
+      out[2] = c2;
+      out[3] = c3;
+      for (int i = 0; i < 9; i++) {
+        round(out, k);
+        k[0] += 0x9E3779B9;
+        k[1] += 0xBB67AE85;
+      }
+      round(out, k);
+    }
+
+    /**
+     * Map a random word to a uniform double in (0, 1)
+     * @param u the random word
+     */
+    static double uniform(uint32_t u) {
+      return (u + 0.5) * (1. / 4294967296.);
+    }
+
+    /**
+     * Generate 4 standard normal numbers for a counter with the Box-Muller transform
+     * @param c0 the first word of the counter
+     * @param c1 the second word of the counter
+     * @param c2 the third word of the counter
+     * @param c3 the fourth word of the counter
+     * @param out receives the normal numbers
+     */
+    void normal(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, double out[4]) const {
+      uint32_t u[4];
+      generate(c0, c1, c2, c3, u);
+      double r0 = sqrt(-2 * log(uniform(u[0])));
+      double r1 = sqrt(-2 * log(uniform(u[2])));
+      double a0 = 2 * M_PI * uniform(u[1]);
+      double a1 = 2 * M_PI * uniform(u[3]);
+      out[0] = r0 * cos(a0);
+      out[1] = r0 * sin(a0);
+      out[2] = r1 * cos(a1);
+      out[3] = r1 * sin(a1);
+    }
+};
+
+#endif
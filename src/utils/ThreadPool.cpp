@@ -0,0 +1,79 @@
+/*
+ * ThreadPool.cpp
+ *
+ * Persistent worker threads for data-parallel loops.
+ */
+
+#include <algorithm>
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threads) {
+  for (int i = 1; i < threads; i++) {
+    workers.push_back(std::thread(&ThreadPool::work, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  start_condition.notify_all();
+  for (auto it = workers.begin(); it != workers.end(); it++) {
+    it->join();
+  }
+}
+
+void ThreadPool::parallelFor(int begin, int end, const Job &job) {
+  if (workers.empty()) {
+    if (begin < end) {
+      job(begin, end, 0);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->job = &job;
+    job_begin = begin;
+    job_end = end;
+    pending = workers.size();
+    generation++;
+  }
+  start_condition.notify_all();
+  run(0);
+  std::unique_lock<std::mutex> lock(mutex);
+  done_condition.wait(lock, [this] { return pending == 0; });
+  this->job = NULL;
+}
+
+void ThreadPool::run(int part) {
+  int parts = size();
+  int chunk = (job_end - job_begin + parts - 1) / parts;
+  chunk = (chunk + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  int begin = std::min(job_end, job_begin + part * chunk);
+  int end = std::min(job_end, begin + chunk);
+  if (begin < end) {
+    (*job)(begin, end, part);
+  }
+}
+
+void ThreadPool::work(int part) {
+  unsigned long seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start_condition.wait(lock, [this, seen] { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+    run(part);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pending == 0) {
+        done_condition.notify_one();
+      }
+    }
+  }
+}
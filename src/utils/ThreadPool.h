@@ -0,0 +1,80 @@
+#ifndef _UTILS_THREADPOOL_H_
+#define _UTILS_THREADPOOL_H_
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A pool of persistent worker threads for data-parallel loops. A loop's range is split into one contiguous
+ * part per thread, the calling thread works on the first part while the workers take the others. Threads
+ * are created once with the pool, and sleep between loops.
+ */
+class ThreadPool {
+  public:
+    /**
+     * The work on a part of a range
+     * @param begin the first index of the part
+     * @param end one past the last index of the part
+     * @param part the index of the part, from 0 to size() - 1
+     */
+    typedef std::function<void(int begin, int end, int part)> Job;
+
+  private:
+    // Part boundaries are multiples of this, so that parts writing to arrays of doubles do not share cache lines
+    static const int ALIGNMENT = 8;
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable start_condition;
+    std::condition_variable done_condition;
+
+    // The current loop
+    const Job *job = NULL;
+    int job_begin = 0;
+    int job_end = 0;
+
+    // Incremented for each loop, so workers can tell a new loop from a spurious wakeup
+    unsigned long generation = 0;
+
+    // Number of workers still working on the current loop
+    int pending = 0;
+
+    bool stopping = false;
+
+    void run(int part);
+    void work(int part);
+
+  public:
+    /**
+     * Create a pool
+     * @param threads the number of threads working on a loop including the calling thread, 1 runs loops
+     *   on the calling thread only
+     */
+    ThreadPool(int threads);
+
+    /**
+     * Stop and join the workers
+     */
+    ~ThreadPool();
+
+    /**
+     * @return the number of threads working on a loop, and so the number of parts a range is split into
+     */
+    int size() const {
+      return workers.size() + 1;
+    }
+
+    /**
+     * Run a job over a range split into size() parts, and wait for all parts to complete. Empty parts are
+     * skipped.
+     * @param begin the first index of the range
+     * @param end one past the last index of the range
+     * @param job the job to run on each part
+     */
+    void parallelFor(int begin, int end, const Job &job);
+};
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * simd_math.h
+ * Vectorized math functions for the SSE2 and AVX2 particle kernels.
+ *
+ * The functions are compiled for their instruction set with target attributes instead of global compiler
+ * flags, so the program still runs on CPUs without AVX2. Callers must pick a variant the CPU supports,
+ * see cpuSupportsAVX2(). Defining PF_NO_SIMD disables all vectorized code.
+ */
+
+#ifndef SIMD_MATH_H_
+#define SIMD_MATH_H_
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(PF_NO_SIMD)
+#define PF_SIMD_X86
+#endif
+
+#ifdef PF_SIMD_X86
+#include <immintrin.h>
+
+#define PF_TARGET_SSE2 __attribute__((target("sse2")))
+#define PF_TARGET_AVX2 __attribute__((target("avx2,fma")))
+
+// Cody-Waite split of PI/2 for the argument reduction of sincos
+#define PF_PIO2_1 1.57079625129699707031E0
+#define PF_PIO2_2 7.54978941586159635336E-8
+#define PF_PIO2_3 5.39030285815811905290E-15
+#define PF_2OPI 0.63661977236758134308
+// 1.5 * 2^52, adding it to a double rounds it to an integer held in the low mantissa bits
+#define PF_ROUND_MAGIC 6755399441055744.0
+
+// Minimax coefficients of sin and cos on [-PI/4, PI/4] (Cephes)
+#define PF_SIN_C0 1.58962301576546568060E-10
+#define PF_SIN_C1 -2.50507477628578072866E-8
+#define PF_SIN_C2 2.75573136213857245213E-6
+#define PF_SIN_C3 -1.98412698295895385996E-4
+#define PF_SIN_C4 8.33333333332211858878E-3
+#define PF_SIN_C5 -1.66666666666666307295E-1
+#define PF_COS_C0 -1.13585365213876817300E-11
+#define PF_COS_C1 2.08757008419747316778E-9
+#define PF_COS_C2 -2.75573141792967388112E-7
+#define PF_COS_C3 2.48015872888517045348E-5
+#define PF_COS_C4 -1.38888888888730564116E-3
+#define PF_COS_C5 4.16666666666665929218E-2
+
+// Cody-Waite split of ln(2) for the argument reduction of exp
+#define PF_LN2_1 6.93145751953125E-1
+#define PF_LN2_2 1.42860682030941723212E-6
+#define PF_LOG2E 1.4426950408889634073599
+// exp() underflows to 0 and overflows to infinity outside of this range
+#define PF_EXP_MIN -708.0
+#define PF_EXP_MAX 709.0
+
+// Pade approximation of exp on [-ln(2)/2, ln(2)/2] (Cephes)
+#define PF_EXP_P0 1.26177193074810590878E-4
+#define PF_EXP_P1 3.02994407707441961300E-2
+#define PF_EXP_P2 9.99999999999999999910E-1
+#define PF_EXP_Q0 3.00198505138664455042E-6
+#define PF_EXP_Q1 2.52448340349684104192E-3
+#define PF_EXP_Q2 2.27265548208155028766E-1
+#define PF_EXP_Q3 2.00000000000000000009E0
+
+// Rational approximation of log(1 + x) on [sqrt(1/2) - 1, sqrt(2) - 1] (Cephes)
+#define PF_LOG_P0 1.01875663804580931796E-4
+#define PF_LOG_P1 4.97494994976747001425E-1
+#define PF_LOG_P2 4.70579119878881725854E0
+#define PF_LOG_P3 1.44989225341610930846E1
+#define PF_LOG_P4 1.79368678507819816313E1
+#define PF_LOG_P5 7.70838733755885391666E0
+#define PF_LOG_Q0 1.12873587189167450590E1
+#define PF_LOG_Q1 4.52279145837532221105E1
+#define PF_LOG_Q2 8.29875266912776603211E1
+#define PF_LOG_Q3 7.11544750618563894466E1
+#define PF_LOG_Q4 2.31251620126765340583E1
+#define PF_SQRTH 0.70710678118654752440
+// 2^52, or'ing a small integer into its mantissa and subtracting it converts the integer to a double
+#define PF_INT_MAGIC 4503599627370496.0
+
+/**
+ * Compute sin and cos of two doubles
+ * @param x the angles [rad]
+ * @param s receives the sines
+ * @param c receives the cosines
+ */
+PF_TARGET_SSE2 inline void sincos_pd(__m128d x, __m128d &s, __m128d &c) {
+  // Reduce x to r in [-PI/4, PI/4] with x = r + q * PI/2
+  __m128d magic = _mm_set1_pd(PF_ROUND_MAGIC);
+  __m128d t = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(PF_2OPI)), magic);
+  __m128i q = _mm_castpd_si128(t);
+  __m128d qd = _mm_sub_pd(t, magic);
+  __m128d r = _mm_sub_pd(x, _mm_mul_pd(qd, _mm_set1_pd(PF_PIO2_1)));
+  r = _mm_sub_pd(r, _mm_mul_pd(qd, _mm_set1_pd(PF_PIO2_2)));
+  r = _mm_sub_pd(r, _mm_mul_pd(qd, _mm_set1_pd(PF_PIO2_3)));
+  __m128d z = _mm_mul_pd(r, r);
+
+  __m128d ps = _mm_set1_pd(PF_SIN_C0);
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(PF_SIN_C1));
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(PF_SIN_C2));
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(PF_SIN_C3));
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(PF_SIN_C4));
+  ps = _mm_add_pd(_mm_mul_pd(ps, z), _mm_set1_pd(PF_SIN_C5));
+  ps = _mm_add_pd(r, _mm_mul_pd(_mm_mul_pd(ps, z), r));
+
+  __m128d pc = _mm_set1_pd(PF_COS_C0);
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(PF_COS_C1));
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(PF_COS_C2));
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(PF_COS_C3));
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(PF_COS_C4));
+  pc = _mm_add_pd(_mm_mul_pd(pc, z), _mm_set1_pd(PF_COS_C5));
+  pc = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1), _mm_mul_pd(z, _mm_set1_pd(0.5))), _mm_mul_pd(_mm_mul_pd(z, z), pc));
+
+  // Odd quadrants swap sin and cos, quadrants 2 and 3 negate sin, quadrants 1 and 2 negate cos
+  __m128i one = _mm_set1_epi32(1);
+  __m128i swap = _mm_cmpeq_epi32(_mm_and_si128(q, one), one);
+  __m128d swap_mask = _mm_castsi128_pd(_mm_shuffle_epi32(swap, _MM_SHUFFLE(2, 2, 0, 0)));
+  __m128d sin_sign = _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(q, _mm_set1_epi64x(2)), 62));
+  __m128d cos_sign = _mm_castsi128_pd(_mm_slli_epi64(_mm_and_si128(_mm_add_epi64(q, _mm_set1_epi64x(1)),
+                                                                    _mm_set1_epi64x(2)), 62));
+  s = _mm_xor_pd(_mm_or_pd(_mm_and_pd(swap_mask, pc), _mm_andnot_pd(swap_mask, ps)), sin_sign);
+  c = _mm_xor_pd(_mm_or_pd(_mm_and_pd(swap_mask, ps), _mm_andnot_pd(swap_mask, pc)), cos_sign);
+}
+
+/**
+ * Compute sin and cos of four doubles
+ * @param x the angles [rad]
+ * @param s receives the sines
+ * @param c receives the cosines
+ */
+PF_TARGET_AVX2 inline void sincos_pd(__m256d x, __m256d &s, __m256d &c) {
+  // Reduce x to r in [-PI/4, PI/4] with x = r + q * PI/2
+  __m256d magic = _mm256_set1_pd(PF_ROUND_MAGIC);
+  __m256d t = _mm256_fmadd_pd(x, _mm256_set1_pd(PF_2OPI), magic);
+  __m256i q = _mm256_castpd_si256(t);
+  __m256d qd = _mm256_sub_pd(t, magic);
+  __m256d r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(PF_PIO2_1), x);
+  r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(PF_PIO2_2), r);
+  r = _mm256_fnmadd_pd(qd, _mm256_set1_pd(PF_PIO2_3), r);
+  __m256d z = _mm256_mul_pd(r, r);
+
+  __m256d ps = _mm256_set1_pd(PF_SIN_C0);
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(PF_SIN_C1));
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(PF_SIN_C2));
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(PF_SIN_C3));
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(PF_SIN_C4));
+  ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(PF_SIN_C5));
+  ps = _mm256_fmadd_pd(_mm256_mul_pd(ps, z), r, r);
+
+  __m256d pc = _mm256_set1_pd(PF_COS_C0);
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(PF_COS_C1));
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(PF_COS_C2));
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(PF_COS_C3));
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(PF_COS_C4));
+  pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(PF_COS_C5));
+  pc = _mm256_fmadd_pd(_mm256_mul_pd(z, z), pc, _mm256_fnmadd_pd(z, _mm256_set1_pd(0.5), _mm256_set1_pd(1)));
+
+  // Odd quadrants swap sin and cos, quadrants 2 and 3 negate sin, quadrants 1 and 2 negate cos
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256i two = _mm256_set1_epi64x(2);
+  __m256d swap_mask = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(q, one), one));
+  __m256d sin_sign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(q, two), 62));
+  __m256d cos_sign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(q, one), two), 62));
+  s = _mm256_xor_pd(_mm256_blendv_pd(ps, pc, swap_mask), sin_sign);
+  c = _mm256_xor_pd(_mm256_blendv_pd(pc, ps, swap_mask), cos_sign);
+}
+
+/**
+ * Compute exp of two doubles, results below PF_EXP_MIN are flushed to 0
+ * @param x the exponents
+ */
+PF_TARGET_SSE2 inline __m128d exp_pd(__m128d x) {
+  __m128d underflow = _mm_cmplt_pd(x, _mm_set1_pd(PF_EXP_MIN));
+  x = _mm_min_pd(_mm_max_pd(x, _mm_set1_pd(PF_EXP_MIN)), _mm_set1_pd(PF_EXP_MAX));
+
+  // Reduce x to r in [-ln(2)/2, ln(2)/2] with x = r + k * ln(2)
+  __m128d magic = _mm_set1_pd(PF_ROUND_MAGIC);
+  __m128d t = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(PF_LOG2E)), magic);
+  __m128i k = _mm_castpd_si128(t);
+  __m128d kd = _mm_sub_pd(t, magic);
+  __m128d r = _mm_sub_pd(x, _mm_mul_pd(kd, _mm_set1_pd(PF_LN2_1)));
+  r = _mm_sub_pd(r, _mm_mul_pd(kd, _mm_set1_pd(PF_LN2_2)));
+  __m128d z = _mm_mul_pd(r, r);
+
+  // exp(r) = 1 + 2 * r * P(r^2) / (Q(r^2) - r * P(r^2))
+  __m128d p = _mm_set1_pd(PF_EXP_P0);
+  p = _mm_add_pd(_mm_mul_pd(p, z), _mm_set1_pd(PF_EXP_P1));
+  p = _mm_add_pd(_mm_mul_pd(p, z), _mm_set1_pd(PF_EXP_P2));
+  p = _mm_mul_pd(p, r);
+  __m128d q = _mm_set1_pd(PF_EXP_Q0);
+  q = _mm_add_pd(_mm_mul_pd(q, z), _mm_set1_pd(PF_EXP_Q1));
+  q = _mm_add_pd(_mm_mul_pd(q, z), _mm_set1_pd(PF_EXP_Q2));
+  q = _mm_add_pd(_mm_mul_pd(q, z), _mm_set1_pd(PF_EXP_Q3));
+  __m128d e = _mm_div_pd(p, _mm_sub_pd(q, p));
+  e = _mm_add_pd(_mm_set1_pd(1), _mm_add_pd(e, e));
+
+  // Scale by 2^k, the low bits of t hold k
+  __m128d scale = _mm_castsi128_pd(_mm_slli_epi64(_mm_add_epi64(k, _mm_set1_epi64x(1023)), 52));
+  return _mm_andnot_pd(underflow, _mm_mul_pd(e, scale));
+}
+
+/**
+ * Compute exp of four doubles, results below PF_EXP_MIN are flushed to 0
+ * @param x the exponents
+ */
+PF_TARGET_AVX2 inline __m256d exp_pd(__m256d x) {
+  __m256d underflow = _mm256_cmp_pd(x, _mm256_set1_pd(PF_EXP_MIN), _CMP_LT_OQ);
+  x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(PF_EXP_MIN)), _mm256_set1_pd(PF_EXP_MAX));
+
+  // Reduce x to r in [-ln(2)/2, ln(2)/2] with x = r + k * ln(2)
+  __m256d magic = _mm256_set1_pd(PF_ROUND_MAGIC);
+  __m256d t = _mm256_fmadd_pd(x, _mm256_set1_pd(PF_LOG2E), magic);
+  __m256i k = _mm256_castpd_si256(t);
+  __m256d kd = _mm256_sub_pd(t, magic);
+  __m256d r = _mm256_fnmadd_pd(kd, _mm256_set1_pd(PF_LN2_1), x);
+  r = _mm256_fnmadd_pd(kd, _mm256_set1_pd(PF_LN2_2), r);
+  __m256d z = _mm256_mul_pd(r, r);
+
+  // exp(r) = 1 + 2 * r * P(r^2) / (Q(r^2) - r * P(r^2))
+  __m256d p = _mm256_set1_pd(PF_EXP_P0);
+  p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(PF_EXP_P1));
+  p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(PF_EXP_P2));
+  p = _mm256_mul_pd(p, r);
+  __m256d q = _mm256_set1_pd(PF_EXP_Q0);
+  q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(PF_EXP_Q1));
+  q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(PF_EXP_Q2));
+  q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(PF_EXP_Q3));
+  __m256d e = _mm256_div_pd(p, _mm256_sub_pd(q, p));
+  e = _mm256_add_pd(_mm256_set1_pd(1), _mm256_add_pd(e, e));
+
+  // Scale by 2^k, the low bits of t hold k
+  __m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(k, _mm256_set1_epi64x(1023)), 52));
+  return _mm256_andnot_pd(underflow, _mm256_mul_pd(e, scale));
+}
+
+/**
+ * Compute the natural logarithm of two positive normal doubles
+ * @param x the arguments
+ */
+PF_TARGET_SSE2 inline __m128d log_pd(__m128d x) {
+  // Split x into m * 2^e with m in [0.5, 1)
+  __m128i bits = _mm_castpd_si128(x);
+  __m128d magic = _mm_set1_pd(PF_INT_MAGIC);
+  __m128d e = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(bits, 52), _mm_castpd_si128(magic))), magic);
+  e = _mm_sub_pd(e, _mm_set1_pd(1022));
+  __m128d m = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi64x(0x000FFFFFFFFFFFFFLL)),
+                                            _mm_set1_epi64x(0x3FE0000000000000LL)));
+
+  // Below sqrt(1/2) use 2 * m and e - 1 instead, then r = m - 1 is in [sqrt(1/2) - 1, sqrt(2) - 1]
+  __m128d small = _mm_cmplt_pd(m, _mm_set1_pd(PF_SQRTH));
+  e = _mm_sub_pd(e, _mm_and_pd(small, _mm_set1_pd(1)));
+  __m128d r = _mm_sub_pd(_mm_add_pd(m, _mm_and_pd(small, m)), _mm_set1_pd(1));
+  __m128d z = _mm_mul_pd(r, r);
+
+  __m128d p = _mm_set1_pd(PF_LOG_P0);
+  p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(PF_LOG_P1));
+  p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(PF_LOG_P2));
+  p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(PF_LOG_P3));
+  p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(PF_LOG_P4));
+  p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(PF_LOG_P5));
+  __m128d q = _mm_add_pd(r, _mm_set1_pd(PF_LOG_Q0));
+  q = _mm_add_pd(_mm_mul_pd(q, r), _mm_set1_pd(PF_LOG_Q1));
+  q = _mm_add_pd(_mm_mul_pd(q, r), _mm_set1_pd(PF_LOG_Q2));
+  q = _mm_add_pd(_mm_mul_pd(q, r), _mm_set1_pd(PF_LOG_Q3));
+  q = _mm_add_pd(_mm_mul_pd(q, r), _mm_set1_pd(PF_LOG_Q4));
+
+  // log(x) = r - r^2 / 2 + r^3 * P(r) / Q(r) + e * ln(2)
+  __m128d y = _mm_mul_pd(_mm_mul_pd(r, z), _mm_div_pd(p, q));
+  y = _mm_add_pd(y, _mm_mul_pd(e, _mm_set1_pd(PF_LN2_2)));
+  y = _mm_sub_pd(y, _mm_mul_pd(z, _mm_set1_pd(0.5)));
+  return _mm_add_pd(_mm_add_pd(r, y), _mm_mul_pd(e, _mm_set1_pd(PF_LN2_1)));
+}
+
+/**
+ * Compute the natural logarithm of four positive normal doubles
+ * @param x the arguments
+ */
+PF_TARGET_AVX2 inline __m256d log_pd(__m256d x) {
+  // Split x into m * 2^e with m in [0.5, 1)
+  __m256i bits = _mm256_castpd_si256(x);
+  __m256d magic = _mm256_set1_pd(PF_INT_MAGIC);
+  __m256d e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52),
+                                                                 _mm256_castpd_si256(magic))), magic);
+  e = _mm256_sub_pd(e, _mm256_set1_pd(1022));
+  __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)),
+                                                  _mm256_set1_epi64x(0x3FE0000000000000LL)));
+
+  // Below sqrt(1/2) use 2 * m and e - 1 instead, then r = m - 1 is in [sqrt(1/2) - 1, sqrt(2) - 1]
+  __m256d small = _mm256_cmp_pd(m, _mm256_set1_pd(PF_SQRTH), _CMP_LT_OQ);
+  e = _mm256_sub_pd(e, _mm256_and_pd(small, _mm256_set1_pd(1)));
+  __m256d r = _mm256_sub_pd(_mm256_add_pd(m, _mm256_and_pd(small, m)), _mm256_set1_pd(1));
+  __m256d z = _mm256_mul_pd(r, r);
+
+  __m256d p = _mm256_set1_pd(PF_LOG_P0);
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(PF_LOG_P1));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(PF_LOG_P2));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(PF_LOG_P3));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(PF_LOG_P4));
+  p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(PF_LOG_P5));
+  __m256d q = _mm256_add_pd(r, _mm256_set1_pd(PF_LOG_Q0));
+  q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(PF_LOG_Q1));
+  q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(PF_LOG_Q2));
+  q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(PF_LOG_Q3));
+  q = _mm256_fmadd_pd(q, r, _mm256_set1_pd(PF_LOG_Q4));
+
+  // log(x) = r - r^2 / 2 + r^3 * P(r) / Q(r) + e * ln(2)
+  __m256d y = _mm256_mul_pd(_mm256_mul_pd(r, z), _mm256_div_pd(p, q));
+  y = _mm256_fmadd_pd(e, _mm256_set1_pd(PF_LN2_2), y);
+  y = _mm256_fnmadd_pd(z, _mm256_set1_pd(0.5), y);
+  return _mm256_fmadd_pd(e, _mm256_set1_pd(PF_LN2_1), _mm256_add_pd(r, y));
+}
+
+#endif /* PF_SIMD_X86 */
+
+/**
+ * Check if the CPU supports the AVX2 kernels
+ */
+inline bool cpuSupportsAVX2() {
+#ifdef PF_SIMD_X86
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+  return false;
+#endif
+}
+
+/**
+ * Check if the CPU supports the SSE2 kernels
+ */
+inline bool cpuSupportsSSE2() {
+#ifdef PF_SIMD_X86
+  return __builtin_cpu_supports("sse2");
+#else
+  return false;
+#endif
+}
+
+#endif /* SIMD_MATH_H_ */